@@ -0,0 +1,59 @@
+#!/bin/sh
+# Reconstructs the small dataset with in-process back-ends and compares the
+# result against a reference volume. Tolerances can be overridden with
+# MAX_ABS, RMSE and PSNR.
+#
+# If the reference does not exist it is generated first: the same run on a
+# single back-end with a single thread, where no reply order or slice split
+# can change the result. With REFERENCE_REV set, that run uses the build of
+# this revision instead, checked out and built once in REFERENCE_TREE
+# (CMAKE_ARGS are passed to cmake). Set UPDATE=1 to replace the reference
+# with the new result instead.
+#
+# ./contrib/regression.sh [reference] [threads] [back_end_nodes] [iterations]
+set -e
+
+REFERENCE=${1:-regression_reference.nii}
+THREADS=${2:-2}
+NODES=${3:-2}
+ITERATIONS=${4:-1}
+OUTPUT=${OUTPUT:-regression.nii}
+TIMINGS=${TIMINGS:-regression_timings.csv}
+REFERENCE_TREE=${REFERENCE_TREE:-build-reference}
+
+# reconstruct <binary> <output> <threads> <back_end_nodes>
+reconstruct() {
+  # A failed run must not leave the output of an earlier one to compare
+  rm -f $2
+  $1 -o $2 -i data/masked_stack-1.nii data/masked_stack-2.nii data/masked_stack-3.nii data/masked_stack-4.nii --disableBiasCorrection --resolution 2.0 --numThreads $3 --iterations ${ITERATIONS} --numNodes $4 --numFrontEndCpus $(($4 + 1)) --localBackends --orderedReplies --timings ${TIMINGS}
+}
+
+if [ ! -f ${REFERENCE} ] && [ -z "${UPDATE}" ]
+then
+  BINARY=./build/reconstruction
+  if [ -n "${REFERENCE_REV}" ]
+  then
+    if [ ! -d ${REFERENCE_TREE} ]
+    then
+      git worktree add --detach ${REFERENCE_TREE} ${REFERENCE_REV}
+      git -C ${REFERENCE_TREE} submodule update --init
+    fi
+    mkdir -p ${REFERENCE_TREE}/build
+    (cd ${REFERENCE_TREE}/build && cmake ${CMAKE_ARGS} .. &&
+      make reconstruction)
+    BINARY=${REFERENCE_TREE}/build/reconstruction
+  fi
+  reconstruct ${BINARY} ${REFERENCE} 1 1
+  echo "generated ${REFERENCE}"
+fi
+
+reconstruct ./build/reconstruction ${OUTPUT} ${THREADS} ${NODES}
+
+if [ -n "${UPDATE}" ]
+then
+  cp ${OUTPUT} ${REFERENCE}
+  echo "updated ${REFERENCE}"
+  exit 0
+fi
+
+./build/reconstruction_compare -o ${OUTPUT} -r ${REFERENCE} --maxAbs ${MAX_ABS:-1.0} --rmse ${RMSE:-0.1} --psnr ${PSNR:-60}
@@ -0,0 +1,431 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Kernel microbenchmarks. Stacks are generated from a synthetic phantom and
+// every front-end step and back-end kernel is timed in isolation, with the
+// back-ends running in-process (see localBackend.h).
+
+#include "../utils.h"
+
+#include "irtkReconstruction.h"
+
+#include <ebbrt/Cpu.h>
+
+#include <boost/program_options.hpp>
+
+#include <cmath>
+#include <functional>
+#include <random>
+
+using namespace ebbrt;
+using namespace std;
+
+namespace po = boost::program_options;
+
+struct benchmarkArguments {
+  int size;
+  int stacks;
+  int repeats;
+  int numThreads;
+  int numBackendNodes;
+  int numFrontendCPUs;
+
+  unsigned int seed;
+
+  double resolution;
+  double spacing;
+  double stackMotion;
+  double sliceMotion;
+};
+
+// A benchmarked kernel, timed over the given back-end phases or, if there
+// are none, by the wall time of the step it belongs to
+struct benchmarkKernel {
+  string name;
+  vector<int> phases;
+  uint64_t voxels;
+  uint64_t coefficients;
+};
+
+struct benchmarkArguments BENCHMARK;
+
+struct arguments ARGUMENTS;
+
+void parseBenchmarkParameters(int argc, char **argv) {
+  try {
+    po::options_description desc("Options");
+    desc.add_options()("help,h", "Print usage messages")
+      ("size",
+        po::value<int>(&BENCHMARK.size)->default_value(64),
+        "Number of voxels along each side of the synthetic volume. "
+        "[Default: 64]")
+      ("resolution",
+        po::value<double>(&BENCHMARK.resolution)->default_value(1.0),
+        "In-plane resolution of the stacks and resolution of the volume. "
+        "[Default: 1mm]")
+      ("spacing",
+        po::value<double>(&BENCHMARK.spacing)->default_value(2.0),
+        "Slice spacing of the stacks. [Default: 2mm]")
+      ("stacks",
+        po::value<int>(&BENCHMARK.stacks)->default_value(3),
+        "Number of stacks, acquired in turn along the three axes. "
+        "[Default: 3]")
+      ("stackMotion",
+        po::value<double>(&BENCHMARK.stackMotion)->default_value(0),
+        "Largest rotation in degrees and translation in mm of the random "
+        "rigid motion of the phantom during each stack. [Default: 0]")
+      ("sliceMotion",
+        po::value<double>(&BENCHMARK.sliceMotion)->default_value(0),
+        "Largest rotation in degrees and translation in mm of the random "
+        "rigid motion of each slice, on top of that of its stack. "
+        "[Default: 0]")
+      ("seed",
+        po::value<unsigned int>(&BENCHMARK.seed)->default_value(1),
+        "Seed of the random motion. [Default: 1]")
+      ("repeats",
+        po::value<int>(&BENCHMARK.repeats)->default_value(3),
+        "Number of times each step is timed. [Default: 3]")
+      ("numThreads",
+        po::value<int>(&BENCHMARK.numThreads)->default_value(1),
+        "Number of threads of each back-end")
+      ("numFrontEndCpus",
+        po::value<int>(&BENCHMARK.numFrontendCPUs)->default_value(2),
+        "Number of front-end EbbRT cpus")
+      ("numNodes",
+        po::value<int>(&BENCHMARK.numBackendNodes)->default_value(1),
+        "Number of back-ends");
+
+    po::variables_map vm;
+    try {
+      po::store(po::command_line_parser(argc, argv)
+          .options(desc).allow_unregistered().run(), vm);
+      if (vm.count("help")) {
+        std::cout << "Microbenchmarks of the reconstruction kernels on "
+                     "synthetic data."
+                  << std::endl
+                  << desc
+                  << std::endl;
+        exit(EXIT_SUCCESS);
+      }
+      po::notify(vm);
+    } catch (po::error &e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << desc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  } catch (std::exception &e) {
+    std::cerr << "Unhandled exception while parsing arguments:  " << e.what()
+              << ", application will now exit" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Reconstruction parameters, as defaulted by reconstruction.cc
+void initializeArguments() {
+  ARGUMENTS.outputName = "benchmark.nii";
+  ARGUMENTS.iterations = 1;
+  ARGUMENTS.levels = 3;
+  ARGUMENTS.recIterationsFirst = 1;
+  ARGUMENTS.recIterationsLast = 1;
+  ARGUMENTS.numThreads = BENCHMARK.numThreads;
+  ARGUMENTS.numBackendNodes = BENCHMARK.numBackendNodes;
+  ARGUMENTS.numFrontendCPUs = BENCHMARK.numFrontendCPUs;
+  ARGUMENTS.psfSubdivisions = 0;
+  ARGUMENTS.coarseIterations = 0;
+  ARGUMENTS.numInputStacksTuner = 0;
+  ARGUMENTS.T1PackageSize = 0;
+  ARGUMENTS.sigma = 12;
+  ARGUMENTS.resolution = BENCHMARK.resolution;
+  ARGUMENTS.averageValue = 700;
+  ARGUMENTS.delta = 150;
+  ARGUMENTS.lambda = 0.02;
+  ARGUMENTS.lastIterLambda = 0.01;
+  ARGUMENTS.smoothMask = 4;
+  ARGUMENTS.lowIntensityCutoff = 0.01;
+  ARGUMENTS.analyticPSF = 0;
+  ARGUMENTS.convergence = 0;
+  ARGUMENTS.coarseFactor = 2;
+  ARGUMENTS.rebalanceThreshold = 0.1;
+  ARGUMENTS.localLatency = 0;
+  ARGUMENTS.localBandwidth = 0;
+  ARGUMENTS.globalBiasCorrection = false;
+  ARGUMENTS.intensityMatching = true;
+  ARGUMENTS.debug = false;
+  ARGUMENTS.disableBiasCorr = true;
+  ARGUMENTS.rebalance = false;
+  ARGUMENTS.localBackends = true;
+  ARGUMENTS.orderedReplies = false;
+}
+
+// Two nested ellipsoids with a smooth intensity ramp, in world coordinates
+double phantom(double x, double y, double z) {
+  double fov = BENCHMARK.size * BENCHMARK.resolution;
+  double a = x / (0.40 * fov);
+  double b = y / (0.35 * fov);
+  double c = z / (0.30 * fov);
+  double r = a * a + b * b + c * c;
+
+  if (r > 1)
+    return 0;
+  if (r > 0.25)
+    return 500 + 100 * a;
+  return 900 + 100 * b;
+}
+
+// Rotations and translations drawn uniformly from [-range, range]
+irtkRigidTransformation randomMotion(std::mt19937& random, double range) {
+  irtkRigidTransformation motion;
+  if (range <= 0)
+    return motion;
+
+  std::uniform_real_distribution<double> uniform(-range, range);
+  motion.PutTranslationX(uniform(random));
+  motion.PutTranslationY(uniform(random));
+  motion.PutTranslationZ(uniform(random));
+  motion.PutRotationX(uniform(random));
+  motion.PutRotationY(uniform(random));
+  motion.PutRotationZ(uniform(random));
+  return motion;
+}
+
+// Stack i covers the volume with slices normal to axis i % 3, shifted by a
+// fraction of the spacing for every further stack along the same axis. The
+// phantom moves rigidly about its centre during the stack, and again for
+// every slice, so that the registrations have motion to recover.
+irtkRealImage createStack(int i, std::mt19937& random) {
+  double fov = BENCHMARK.size * BENCHMARK.resolution;
+  double axes[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  int normal = i % 3;
+  int u = (normal + 1) % 3;
+  int v = (normal + 2) % 3;
+  int repeat = i / 3;
+  int repeats = (BENCHMARK.stacks + 2) / 3;
+
+  irtkImageAttributes attr;
+  attr._x = BENCHMARK.size;
+  attr._y = BENCHMARK.size;
+  attr._z = (int) ceil(fov / BENCHMARK.spacing);
+  attr._dx = BENCHMARK.resolution;
+  attr._dy = BENCHMARK.resolution;
+  attr._dz = BENCHMARK.spacing;
+  for (int j = 0; j < 3; j++) {
+    attr._xaxis[j] = axes[u][j];
+    attr._yaxis[j] = axes[v][j];
+    attr._zaxis[j] = axes[normal][j];
+  }
+  double shift = BENCHMARK.spacing * repeat / repeats;
+  attr._xorigin = shift * axes[normal][0];
+  attr._yorigin = shift * axes[normal][1];
+  attr._zorigin = shift * axes[normal][2];
+
+  irtkRealImage stack(attr);
+  auto stackMotion = randomMotion(random, BENCHMARK.stackMotion);
+  for (int z = 0; z < stack.GetZ(); z++) {
+    auto sliceMotion = randomMotion(random, BENCHMARK.sliceMotion);
+    for (int y = 0; y < stack.GetY(); y++) {
+      for (int x = 0; x < stack.GetX(); x++) {
+        double wx = x, wy = y, wz = z;
+        stack.ImageToWorld(wx, wy, wz);
+        sliceMotion.Transform(wx, wy, wz);
+        stackMotion.Transform(wx, wy, wz);
+        stack(x, y, z) = phantom(wx, wy, wz);
+      }
+    }
+  }
+
+  return stack;
+}
+
+void printKernel(string step, struct benchmarkKernel& kernel, double seconds) {
+  cout << "[Benchmark] " << step << "," << kernel.name << "," << seconds
+    << "," << kernel.voxels / seconds / 1e6 << ",";
+  if (kernel.coefficients > 0)
+    cout << kernel.coefficients / seconds / 1e6;
+  cout << endl;
+}
+
+// Runs step BENCHMARK.repeats times and prints the mean time per call of each
+// of its kernels. Back-end kernels are charged the time of the slowest
+// back-end, which is what the front-end waits for.
+void measure(string name, std::function<void()> step,
+    vector<struct benchmarkKernel> kernels) {
+  vector<phases_data> before;
+  for (int node = 0; node < BENCHMARK.numBackendNodes; node++)
+    before.push_back(LocalBackendPhases(node));
+
+  auto start = startTimer();
+  for (int i = 0; i < BENCHMARK.repeats; i++)
+    step();
+  double wall = endTimer(start) / BENCHMARK.repeats;
+
+  for (auto& kernel : kernels) {
+    double seconds = 0;
+    if (kernel.phases.empty()) {
+      seconds = wall;
+    } else {
+      for (int node = 0; node < BENCHMARK.numBackendNodes; node++) {
+        auto after = LocalBackendPhases(node);
+        double busy = 0;
+        for (auto phase : kernel.phases)
+          busy += NsToSeconds(after[phase].time -
+              before[node][phase].time);
+        seconds = max(seconds, busy / BENCHMARK.repeats);
+      }
+    }
+    printKernel(name, kernel, seconds);
+  }
+}
+
+void runBenchmark(EbbRef<irtkReconstruction> reconstruction) {
+  vector<irtkRealImage> stacks;
+  vector<irtkRigidTransformation> stackTransformations;
+  int templateNumber = 0;
+
+  // The motion is left for the registrations to find
+  std::mt19937 random(BENCHMARK.seed);
+  for (int i = 0; i < BENCHMARK.stacks; i++) {
+    stacks.push_back(createStack(i, random));
+    stackTransformations.push_back(irtkRigidTransformation());
+    ARGUMENTS.thickness.push_back(2 * BENCHMARK.spacing);
+  }
+
+  reconstruction->SetParameters(ARGUMENTS);
+
+  irtkRealImage mask = reconstruction->CreateMask(stacks[templateNumber]);
+  irtkRealImage m = mask;
+  reconstruction->TransformMask(stacks[templateNumber], m,
+      stackTransformations[templateNumber]);
+  reconstruction->CropImage(stacks[templateNumber], m);
+
+  reconstruction->CreateTemplate(stacks[templateNumber],
+      BENCHMARK.resolution);
+  reconstruction->SetMask(&mask, ARGUMENTS.smoothMask);
+
+  uint64_t stackVoxels = 0;
+  for (auto& stack : stacks)
+    stackVoxels += stack.GetNumberOfVoxels();
+
+  cout << "[Benchmark] step,kernel,seconds,Mvoxels/s,Mcoefficients/s" << endl;
+
+  measure("StackRegistrations", [&]() {
+      reconstruction->StackRegistrations(stacks, stackTransformations,
+          templateNumber);
+    }, {{"StackRegistrations", {}, stackVoxels, 0}});
+
+  for (int i = 0; i < (int) stacks.size(); i++) {
+    if (i == templateNumber)
+      continue;
+    irtkRealImage sm = reconstruction->GetMask();
+    reconstruction->TransformMask(stacks[i], sm, stackTransformations[i]);
+    reconstruction->CropImage(stacks[i], sm);
+  }
+
+  reconstruction->MatchStackIntensitiesWithMasking(stacks,
+      stackTransformations, ARGUMENTS.averageValue, false);
+
+  reconstruction->CreateSlicesAndTransformations(stacks, stackTransformations,
+      ARGUMENTS.thickness);
+  reconstruction->MaskSlices();
+  reconstruction->InitializeEM();
+
+  uint64_t sliceVoxels = 0;
+  for (auto& stack : stacks) {
+    irtkRealPixel *ptr = stack.GetPointerToVoxels();
+    for (int i = 0; i < stack.GetNumberOfVoxels(); i++, ptr++)
+      if (*ptr != -1)
+        sliceVoxels++;
+  }
+
+  // Distribute the slices and compute the coefficients once before timing
+  reconstruction->InitializeEMValues();
+  reconstruction->CoeffInit(0);
+  reconstruction->GaussianReconstruction();
+
+  uint64_t coefficients = LocalBackendCoefficients();
+  uint64_t volumeVoxels = reconstruction->GetReconstructed().GetNumberOfVoxels();
+
+  measure("CoeffInit", [&]() {
+      reconstruction->InitializeEMValues();
+      reconstruction->CoeffInit(1);
+      reconstruction->GaussianReconstruction();
+    }, {{"ParallelCoeffInit", {COEFF_INIT}, sliceVoxels, coefficients},
+        {"GaussianReconstruction", {GAUSSIAN_RECONSTRUCTION}, sliceVoxels,
+          coefficients}});
+
+  measure("InitializeRobustStatistics", [&]() {
+      reconstruction->SimulateSlices(true);
+      reconstruction->InitializeRobustStatistics();
+    }, {{"SimulateSlices", {SIMULATE_SLICES}, sliceVoxels, coefficients},
+        {"InitializeRobustStatistics", {INITIALIZE_ROBUST_STATISTICS},
+          sliceVoxels, 0}});
+
+  measure("EStep", [&]() { reconstruction->EStep(); },
+      {{"EStep", {E_STEP_I, E_STEP_II, E_STEP_III}, sliceVoxels, 0}});
+
+  measure("Scale", [&]() { reconstruction->Scale(); },
+      {{"Scale", {SCALE}, sliceVoxels, 0}});
+
+  measure("SuperResolution", [&]() { reconstruction->SuperResolution(1); },
+      {{"SuperResolution", {SUPERRESOLUTION}, sliceVoxels, coefficients},
+       {"SuperResolution (front-end)", {}, volumeVoxels, 0}});
+
+  measure("MStep", [&]() {
+      reconstruction->SimulateSlices(false);
+      reconstruction->MStep(1);
+    }, {{"SimulateSlices", {SIMULATE_SLICES}, sliceVoxels, coefficients},
+        {"MStep", {M_STEP}, sliceVoxels, 0}});
+
+  irtkRealImage original = reconstruction->GetReconstructed();
+
+  measure("AdaptiveRegularization", [&]() {
+      reconstruction->AdaptiveRegularization(1, original);
+    }, {{"AdaptiveRegularization", {}, volumeVoxels, 0}});
+
+  measure("BiasCorrectVolume", [&]() {
+      reconstruction->BiasCorrectVolume(original);
+    }, {{"BiasCorrectVolume", {}, volumeVoxels, 0}});
+
+  measure("SliceToVolumeRegistration", [&]() {
+      reconstruction->SliceToVolumeRegistration();
+    }, {{"SliceToVolumeRegistration", {SLICE_TO_VOLUME_REGISTRATION},
+      sliceVoxels, 0}});
+
+  cout << "[Benchmark] slice voxels: " << sliceVoxels << endl;
+  cout << "[Benchmark] volume voxels: " << volumeVoxels << endl;
+  cout << "[Benchmark] coefficients: " << coefficients << endl;
+
+  ebbrt::Cpu::Exit(EXIT_SUCCESS);
+}
+
+void AppMain() {
+  int cpu_num = ebbrt::Cpu::GetPhysCpus();
+  auto benchmarkCPU = (ebbrt::Cpu::GetMine() + 1) % cpu_num;
+
+  initializeArguments();
+
+  auto reconstruction = irtkReconstruction::Create();
+
+  struct localBackendLink link;
+  link.latency = 0;
+  link.bandwidth = 0;
+  reconstruction->AddLocalBackends(BENCHMARK.numBackendNodes, link);
+
+  auto ctxt = ebbrt::Cpu::GetByIndex(benchmarkCPU)->get_context();
+  ebbrt::event_manager->SpawnRemote([reconstruction]() {
+      runBenchmark(reconstruction);
+    }, ctxt);
+}
+
+int main(int argc, char **argv) {
+  void* status;
+
+  parseBenchmarkParameters(argc, argv);
+
+  pthread_t tid = ebbrt::Cpu::EarlyInit((size_t) BENCHMARK.numFrontendCPUs);
+  pthread_join(tid, &status);
+
+  ebbrt::Cpu::Exit(EXIT_SUCCESS);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+// Compares a reconstructed volume against a reference volume and fails if
+// they differ by more than the given voxel-wise tolerances.
+
+#include <irtkImage.h>
+
+#include <boost/program_options.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+struct compareArguments {
+  string output;
+  string reference;
+
+  double maxAbs;
+  double rmse;
+  double psnr;
+};
+
+struct compareArguments COMPARE;
+
+void parseCompareParameters(int argc, char **argv) {
+  try {
+    po::options_description desc("Options");
+    desc.add_options()("help,h", "Print usage messages")
+      ("output,o",
+        po::value<string>(&COMPARE.output)->required(),
+        "Reconstructed volume to check.")
+      ("reference,r",
+        po::value<string>(&COMPARE.reference)->required(),
+        "Reference volume.")
+      ("maxAbs",
+        po::value<double>(&COMPARE.maxAbs)->default_value(1.0),
+        "Largest absolute difference allowed in any voxel, negative to "
+        "disable. [Default: 1.0]")
+      ("rmse",
+        po::value<double>(&COMPARE.rmse)->default_value(0.1),
+        "Largest root mean square difference allowed, negative to disable. "
+        "[Default: 0.1]")
+      ("psnr",
+        po::value<double>(&COMPARE.psnr)->default_value(60),
+        "Smallest peak signal to noise ratio in dB allowed, relative to the "
+        "reference maximum, 0 or negative to disable. [Default: 60]");
+
+    po::variables_map vm;
+    try {
+      po::store(po::parse_command_line(argc, argv, desc), vm);
+      if (vm.count("help")) {
+        std::cout << "Voxel-wise comparison of two volumes." << std::endl
+                  << desc << std::endl;
+        exit(EXIT_SUCCESS);
+      }
+      po::notify(vm);
+    } catch (po::error &e) {
+      std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
+      std::cerr << desc << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  } catch (std::exception &e) {
+    std::cerr << "Unhandled exception while parsing arguments:  " << e.what()
+              << ", application will now exit" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+int main(int argc, char **argv) {
+  parseCompareParameters(argc, argv);
+
+  irtkRealImage output(COMPARE.output.c_str());
+  irtkRealImage reference(COMPARE.reference.c_str());
+
+  if (output.GetX() != reference.GetX() || output.GetY() != reference.GetY() ||
+      output.GetZ() != reference.GetZ() || output.GetT() != reference.GetT()) {
+    cerr << "ERROR: " << COMPARE.output << " is " << output.GetX() << "x"
+      << output.GetY() << "x" << output.GetZ() << "x" << output.GetT()
+      << " but " << COMPARE.reference << " is " << reference.GetX() << "x"
+      << reference.GetY() << "x" << reference.GetZ() << "x"
+      << reference.GetT() << endl;
+    return EXIT_FAILURE;
+  }
+
+  irtkRealPixel *op = output.GetPointerToVoxels();
+  irtkRealPixel *rp = reference.GetPointerToVoxels();
+  int n = reference.GetNumberOfVoxels();
+
+  double maxAbs = 0;
+  double squares = 0;
+  double peak = 0;
+  for (int i = 0; i < n; i++, op++, rp++) {
+    double diff = fabs(*op - *rp);
+    maxAbs = max(maxAbs, diff);
+    squares += diff * diff;
+    peak = max(peak, fabs(*rp));
+  }
+
+  double rmse = sqrt(squares / n);
+  double psnr = (rmse > 0) ? 20 * log10(peak / rmse) : INFINITY;
+
+  cout << "[compare] max abs: " << maxAbs << endl;
+  cout << "[compare] rmse: " << rmse << endl;
+  cout << "[compare] psnr: " << psnr << endl;
+
+  bool pass = true;
+  if (COMPARE.maxAbs >= 0 && maxAbs > COMPARE.maxAbs) {
+    cout << "[compare] max abs above " << COMPARE.maxAbs << endl;
+    pass = false;
+  }
+  if (COMPARE.rmse >= 0 && rmse > COMPARE.rmse) {
+    cout << "[compare] rmse above " << COMPARE.rmse << endl;
+    pass = false;
+  }
+  if (COMPARE.psnr > 0 && psnr < COMPARE.psnr) {
+    cout << "[compare] psnr below " << COMPARE.psnr << endl;
+    pass = false;
+  }
+
+  cout << "[compare] " << (pass ? "PASS" : "FAIL") << endl;
+  return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,6 +15,10 @@
 #include <ebbrt/EbbRef.h>
 #include <ebbrt/LocalIdMap.h>
 
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
 #pragma GCC diagnostic ignored "-Wunused-variable"
 #pragma GCC diagnostic ignored "-Wsign-compare"
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
@@ -74,6 +78,7 @@ void irtkReconstruction::Ping(Messenger::NetworkId nid) {
 
 void irtkReconstruction::SetDefaultParameters() {
   _qualityFactor = 2;
+  _psfRadius = 0;
 
   _step = 0.0001;
   _sigmaBias = 12;
@@ -85,6 +90,15 @@ void irtkReconstruction::SetDefaultParameters() {
   _templateCreated = false;
   _haveMask = false;
   _adaptive = false;
+  _rebalance = false;
+  _orderedReplies = false;
+  _rebalanceThreshold = 0.1;
+  _resume = false;
+  _metricsEnabled = false;
+  _traceEnabled = false;
+  _outerIteration = 0;
+  _innerIteration = 0;
+  _innerIterations = 0;
 
   int directions[13][3] = {{1, 0, -1}, {0, 1, -1}, {1, 1, -1}, {1, -1, -1},
     {1, 0, 0},  {0, 1, 0},  {1, 1, 0},  {1, -1, 0},
@@ -95,6 +109,13 @@ void irtkReconstruction::SetDefaultParameters() {
       _directions[i][j] = directions[i][j];
 
   _nids.clear();
+  _localBackends = false;
+  _localBackendBase = 0;
+  _backendsReady = false;
+  _streamSlices = false;
+  _streamed = false;
+  _coarse = false;
+  _gridChanged = false;
 
   _reconRecv = 0;
   _totalBytes = 0;
@@ -109,6 +130,8 @@ void irtkReconstruction::SetDefaultParameters() {
 irtkReconstruction::irtkReconstruction(EbbId ebbid)
   : Messagable<irtkReconstruction>(ebbid) {
     irtkReconstruction::SetDefaultParameters();
+    _traceOrigin = TimerNow();
+    _gatherPhase = 0;
   }
 
 void irtkReconstruction::SetParameters(arguments args) {
@@ -127,6 +150,8 @@ void irtkReconstruction::SetParameters(arguments args) {
   _numThreads = args.numThreads; // Not used
   _numBackendNodes = args.numBackendNodes; 
   _numFrontendCPUs = args.numFrontendCPUs; // Not used
+  _psfSubdivisions = args.psfSubdivisions;
+  _coarseIterations = args.coarseIterations;
 
   _sigma = (args.sigma) > 0 ? args.sigma : 20;
   _resolution = args.resolution; // Not used
@@ -136,13 +161,118 @@ void irtkReconstruction::SetParameters(arguments args) {
   _lambda = args.lambda; 
   _alpha = (0.05 / _lambda) * _delta * _delta;
   _lastIterLambda = args.lastIterLambda; // Not used
+  _convergence = args.convergence;
   _smoothMask = args.smoothMask; // Not used
   _lowIntensityCutoff = (args.lowIntensityCutoff > 1) ? 1 : 0; // Not used
+  _analyticPSF = args.analyticPSF;
+  _coarseFactor = args.coarseFactor;
 
   _globalBiasCorrection = args.globalBiasCorrection; 
   _intensityMatching = args.intensityMatching; 
   _debug = args.debug; 
   _disableBiasCorr = args.disableBiasCorr; // Not used
+  _rebalance = args.rebalance;
+  _orderedReplies = args.orderedReplies;
+  _rebalanceThreshold = args.rebalanceThreshold;
+  _checkpointName = args.checkpointFile;
+  _resume = args.resume;
+  // The backends of a batch are busy with the previous subject, and slices
+  // read from --tFolder get their transformations after they are created
+  _streamSlices = args.streamSlices && args.batchFile.empty() &&
+    args.tFolder.empty();
+  _intermediatesFolder = args.intermediatesFolder;
+  _traceEnabled = !args.traceFile.empty();
+  if (args.asyncOutput)
+    _writer.Start(_numThreads);
+}
+
+/*
+ * Prepares the front-end for the next subject of a batch. The backends are
+ * kept and bootstrapped again by the first CoeffInit() of the subject.
+ */
+void irtkReconstruction::Reset() {
+  _qualityFactor = 2;
+  _psfRadius = 0;
+  _step = 0.0001;
+  _sigmaBias = 12;
+  _sigmaSCPU = 0.025;
+  _sigmaS2CPU = 0.025;
+  _mixSCPU = 0.9;
+  _mixCPU = 0.9;
+
+  _templateCreated = false;
+  _haveMask = false;
+  _outerIteration = 0;
+  _innerIteration = 0;
+  _innerIterations = 0;
+
+  _reconRecv = 0;
+  _totalBytes = 0;
+  _tsigma = 0;
+  _tmix = 0;
+  _tnum = 0;
+
+  _tmin = voxel_limits<irtkRealPixel>::max();
+  _tmax = voxel_limits<irtkRealPixel>::min();
+
+  _slices.clear();
+  _simulatedSlices.clear();
+  _simulatedWeights.clear();
+  _simulatedInside.clear();
+  _stackIndex.clear();
+  _stackFactor.clear();
+  _transformations.clear();
+  _smallSlices.clear();
+  _streamed = false;
+  _coarse = false;
+  _gridChanged = false;
+
+  // Statistics are per subject
+  _phase_performance = phases_data();
+  _migration = phase_data();
+  for (auto& messages : _nodeMessages)
+    messages = messages_data();
+  for (auto& phases : _backend_performance)
+    phases = phases_data();
+  for (auto& workers : _backendWorkers)
+    workers.clear();
+  for (auto& messages : _backendMessages)
+    messages = messages_data();
+  for (auto& counters : _backendCounters)
+    counters = counters_data();
+  {
+    std::lock_guard<std::mutex> l(_traceMutex);
+    _trace.clear();
+  }
+  for (auto& trace : _backendTrace)
+    trace.clear();
+  _traceOrigin = TimerNow();
+
+  _reconstructionDone = ebbrt::Promise<void>();
+}
+
+/*
+ * Frees the state the backends keep for the subject of this front-end, so
+ * that the front-ends of a batch do not each hold a subject on every backend
+ */
+void irtkReconstruction::ReleaseBackends() {
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
+    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
+    auto ctxt = cpu_i->get_context();  // context
+
+    ebbrt::event_manager->SpawnRemote([this, i]() {
+
+    auto buf = MakeUniqueIOBuf(sizeof(int));
+    auto dp = buf->GetMutDataPointer();
+
+    dp.Get<int>() = RELEASE;
+
+    // No reply comes back for a release
+    SendToBackend(i, std::move(buf), false);
+    }, ctxt);
+  }
 }
 
 /*
@@ -152,27 +282,119 @@ ebbrt::Future<void> irtkReconstruction::WaitPool() {
   return std::move(_backendsAllocated.GetFuture());
 }
 
+// Backend nodes are served by the front-end cores from the last one down
+size_t irtkReconstruction::ReserveBackendCpu() {
+  int cpu_num = ebbrt::Cpu::GetPhysCpus();
+  size_t index = cpu_num - 1 - (_backendCpus.size() % cpu_num);
+  _backendCpus.push_back(index);
+  return index;
+}
+
 void irtkReconstruction::AddNid(ebbrt::Messenger::NetworkId nid) {
   _nids.push_back(nid);
+  SizeNodeCounters();
 
   cout << "Adding a network id, working on CPU " << ebbrt::Cpu::GetMine() << endl;
 
-  int cpu_num = ebbrt::Cpu::GetPhysCpus();
-  auto index = (cpu_num - (int)_nids.size()) % cpu_num;
+  auto index = ReserveBackendCpu();
   auto cpu_i = ebbrt::Cpu::GetByIndex(index);
   auto ctxt = cpu_i->get_context();
 
   cout << "CPU: " << index << " was reserved for " << nid.ToString() << endl;  
-
-  _frontEnd_cpus_map.insert(make_pair(nid.ToString(), index));
  
   ebbrt::event_manager->SpawnRemote([this, nid]() { Ping(nid); }, ctxt);
  
   if ((int) _nids.size() == _numBackendNodes) {
+    _backendsReady = true;
     _backendsAllocated.SetValue();
   }
 }
 
+void irtkReconstruction::AddLocalBackends(int numNodes, 
+    struct localBackendLink link) {
+  _localBackends = true;
+  _numBackendNodes = numNodes;
+  SizeNodeCounters();
+
+  _localBackendBase = CreateLocalBackends(numNodes, link,
+      [this](int node, std::unique_ptr<ebbrt::IOBuf>&& buffer) {
+        ReceiveFromBackend(node, std::move(buffer));
+      });
+
+  for (int i = 0; i < numNodes; i++) {
+    auto index = ReserveBackendCpu();
+    cout << "CPU: " << index << " was reserved for " << BackendName(i) << endl;
+  }
+
+  _backendsReady = true;
+  _backendsAllocated.SetValue();
+}
+
+// Sized when the backends register, before any message is exchanged
+void irtkReconstruction::SizeNodeCounters() {
+  std::lock_guard<std::mutex> l(_m);
+  _nodeMessages.resize(_numBackendNodes);
+  _requestTime.resize(_numBackendNodes);
+  _requestType.resize(_numBackendNodes);
+}
+
+void irtkReconstruction::SendToBackend(int node, 
+    std::unique_ptr<ebbrt::IOBuf>&& buf, bool answered) {
+  // Every message starts with the function it belongs to, which is also the
+  // phase the next Gather() waits for
+  auto fn = *(const int*) buf->Data();
+  auto now = TimerNow();
+  auto len = buf->ComputeChainDataLength();
+  auto serialize = TakeSerializeTime();
+  Trace(TRACE_SEND, fn, len, now, now);
+
+  // Requests are sent from several front-end cores. The lock is released
+  // before sending since local backends may reply inline.
+  {
+    std::lock_guard<std::mutex> l(_m);
+    auto& message = _nodeMessages[node][MessageType(fn)];
+    message.sent++;
+    message.sentBytes += len;
+    message.serialize += serialize;
+
+    // A request is answered by one reply, which closes the round trip.
+    // Messages that are not answered leave the pending request alone.
+    if (answered) {
+      _gatherPhase = fn;
+      _requestTime[node] = now;
+      _requestType[node] = MessageType(fn);
+    }
+  }
+
+  if (_localBackends)
+    SendToLocalBackend(_localBackendBase + node, std::move(buf));
+  else
+    SendMessage(_nids[node], std::move(buf));
+}
+
+void irtkReconstruction::Trace(uint32_t type, int phase, uint32_t bytes,
+    uint64_t begin, uint64_t end) {
+  if (!_traceEnabled)
+    return;
+
+  struct trace_event event;
+  event.type = type;
+  event.phase = phase;
+  event.thread = ebbrt::Cpu::GetMine();
+  event.bytes = bytes;
+  event.begin = begin;
+  event.end = end;
+
+  std::lock_guard<std::mutex> l(_traceMutex);
+  _trace.push_back(event);
+}
+
+string irtkReconstruction::BackendName(int node) {
+  if (_localBackends)
+    return "local backend " + std::to_string(node);
+  return _nids[node].ToString();
+}
+
 
 /*
  * Fetal Reconstruction functions
@@ -191,6 +413,7 @@ void irtkReconstruction::ReturnFrom() {
 }
 
 void irtkReconstruction::AssembleImage(ebbrt::IOBuf::DataPointer & dp) { 
+  serializeTimer timer(DeserializeTime());
 
   int start = dp.Get<int>();
   int end = dp.Get<int>();
@@ -278,6 +501,11 @@ void irtkReconstruction::ReturnFromEStepIII(ebbrt::IOBuf::DataPointer & dp) {
   _sum += parameters.sum;
   _num += parameters.num;
 
+  int start = dp.Get<int>();
+  int end = dp.Get<int>();
+  dp.Get((end - start) * sizeof(double),
+      (uint8_t *) (_sliceWeightCPU.data() + start));
+
   ReturnFrom();
 }
 
@@ -330,6 +558,7 @@ void irtkReconstruction::ReturnFromSliceToVolumeRegistration(
     ebbrt::IOBuf::DataPointer & dp) {
   int start = dp.Get<int>();
   int end = dp.Get<int>();
+  int nRigidTrans = dp.Get<int>();
 
   for(int i = start; i < end; i++) {
     deserializeTransformations(dp, _transformations[i]);
@@ -339,9 +568,31 @@ void irtkReconstruction::ReturnFromSliceToVolumeRegistration(
 }
 
 void irtkReconstruction::ReturnFromGatherTimers(
-    ebbrt::IOBuf::DataPointer & dp) {
+    ebbrt::IOBuf::DataPointer & dp, int node) {
   auto phases = dp.Get<phases_data>();
-  _backend_performance.emplace_back(phases);
+  _backend_performance[node] = phases;
+
+  auto workers = dp.Get<uint32_t>();
+  _backendWorkers[node].resize(workers);
+  for (uint32_t i = 0; i < workers; i++)
+    _backendWorkers[node][i] = dp.Get<worker_phases_data>();
+
+  _backendMessages[node] = dp.Get<messages_data>();
+  _backendCounters[node] = dp.Get<counters_data>();
+
+  // Assume the reply was sent halfway between request and receipt
+  auto now = TimerNow();
+  auto backendNow = dp.Get<uint64_t>();
+  _backendClockOffset[node] = (int64_t) backendNow -
+    (int64_t) ((_traceRequestTime[node] + now) / 2);
+
+  // Events recorded since the previous gather
+  auto count = dp.Get<uint32_t>();
+  auto first = _backendTrace[node].size();
+  _backendTrace[node].resize(first + count);
+  for (uint32_t i = first; i < first + count; i++)
+    _backendTrace[node][i] = dp.Get<struct trace_event>();
+
   ReturnFrom();
 }
 
@@ -378,100 +629,60 @@ void irtkReconstruction::TransformMask(
   mask = m;
 }
 
+class ParallelBoundingBox {
+  irtkRealImage &mask;
+  int nx, ny, nz;
+
+  public:
+  int x1, x2, y1, y2, z1, z2;
+
+  ParallelBoundingBox(irtkRealImage &_mask, int _nx, int _ny, int _nz)
+    : mask(_mask) {
+      nx = _nx, ny = _ny, nz = _nz;
+      // empty box, as left by the per-bound scans when the mask is empty
+      x1 = _nx, y1 = _ny, z1 = _nz;
+      x2 = -1, y2 = -1, z2 = -1;
+    }
+
+  ParallelBoundingBox(ParallelBoundingBox &x, split)
+    : mask(x.mask) {
+      nx = x.nx, ny = x.ny, nz = x.nz;
+      x1 = nx, y1 = ny, z1 = nz;
+      x2 = -1, y2 = -1, z2 = -1;
+    }
+
+  void join(const ParallelBoundingBox &y) {
+    x1 = min(x1, y.x1), y1 = min(y1, y.y1), z1 = min(z1, y.z1);
+    x2 = max(x2, y.x2), y2 = max(y2, y.y2), z2 = max(z2, y.z2);
+  }
+
+  void operator()(const blocked_range<size_t> &r) {
+    for (size_t k = r.begin(); k != r.end(); ++k)
+      for (int j = 0; j < ny; j++)
+        for (int i = 0; i < nx; i++)
+          if (mask.Get(i, j, k) > 0) {
+            x1 = min(x1, i), x2 = max(x2, i);
+            y1 = min(y1, j), y2 = max(y2, j);
+            z1 = min(z1, (int)k), z2 = max(z2, (int)k);
+          }
+  }
+};
+
 void irtkReconstruction::CropImage(irtkRealImage &image,
     irtkRealImage &mask) {
   // [fetalReconstruction] Crops the image according to the mask
 
-  int i, j, k;
-  // [fetalReconstruction] ROI boundaries
-  int x1, x2, y1, y2, z1, z2;
+  // [fetalReconstruction] ROI boundaries, found in a single pass over the
+  // mask
+  ParallelBoundingBox box(mask, image.GetX(), image.GetY(), image.GetZ());
+  task_scheduler_init init(_numThreads);
+  parallel_reduce(blocked_range<size_t>(0, image.GetZ()), box);
+  init.terminate();
+
+  int x1 = box.x1, x2 = box.x2;
+  int y1 = box.y1, y2 = box.y2;
+  int z1 = box.z1, z2 = box.z2;
 
-  // [fetalReconstruction] Original ROI
-  x1 = 0;
-  y1 = 0;
-  z1 = 0;
-  x2 = image.GetX();
-  y2 = image.GetY();
-  z2 = image.GetZ();
-
-  // [fetalReconstruction] upper boundary for z coordinate
-  int sum = 0;
-  for (k = image.GetZ() - 1; k >= 0; k--) {
-    sum = 0;
-    for (j = image.GetY() - 1; j >= 0; j--)
-      for (i = image.GetX() - 1; i >= 0; i--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-  z2 = k;
-
-  // [fetalReconstruction] lower boundary for z coordinate
-  sum = 0;
-  for (k = 0; k <= image.GetZ() - 1; k++) {
-    sum = 0;
-    for (j = image.GetY() - 1; j >= 0; j--)
-      for (i = image.GetX() - 1; i >= 0; i--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-  z1 = k;
-
-  // [fetalReconstruction] upper boundary for y coordinate
-  sum = 0;
-  for (j = image.GetY() - 1; j >= 0; j--) {
-    sum = 0;
-    for (k = image.GetZ() - 1; k >= 0; k--)
-      for (i = image.GetX() - 1; i >= 0; i--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-  y2 = j;
-
-  // [fetalReconstruction] lower boundary for y coordinate
-  sum = 0;
-  for (j = 0; j <= image.GetY() - 1; j++) {
-    sum = 0;
-    for (k = image.GetZ() - 1; k >= 0; k--)
-      for (i = image.GetX() - 1; i >= 0; i--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-  y1 = j;
-
-  // [fetalReconstruction] upper boundary for x coordinate
-  sum = 0;
-  for (i = image.GetX() - 1; i >= 0; i--) {
-    sum = 0;
-    for (k = image.GetZ() - 1; k >= 0; k--)
-      for (j = image.GetY() - 1; j >= 0; j--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-  x2 = i;
-
-  // [fetalReconstruction] lower boundary for x coordinate
-  sum = 0;
-  for (i = 0; i <= image.GetX() - 1; i++) {
-    sum = 0;
-    for (k = image.GetZ() - 1; k >= 0; k--)
-      for (j = image.GetY() - 1; j >= 0; j--)
-        if (mask.Get(i, j, k) > 0)
-          sum++;
-    if (sum > 0)
-      break;
-  }
-
-  x1 = i;
   if (_debug)
     cout << "Region of interest is " << x1 << " " << y1 << " " << z1 << " "
       << " " << x2 << " " << y2 << " " << z2 << endl;
@@ -480,6 +691,52 @@ void irtkReconstruction::CropImage(irtkRealImage &image,
   image = image.GetRegion(x1, y1, z1, x2 + 1, y2 + 1, z2 + 1);
 }
 
+class ParallelMaskStacks {
+  irtkReconstruction *reconstructor;
+  vector<irtkRealImage> &stacks;
+  vector<irtkRigidTransformation> &stack_transformations;
+  int templateNumber;
+  int nt;
+
+  public:
+  ParallelMaskStacks(irtkReconstruction *_reconstructor,
+      vector<irtkRealImage> &_stacks,
+      vector<irtkRigidTransformation> &_stack_transformations,
+      int _templateNumber, int _nt)
+    : reconstructor(_reconstructor), stacks(_stacks),
+    stack_transformations(_stack_transformations) {
+      templateNumber = _templateNumber, nt = _nt;
+    }
+
+  void operator()(const blocked_range<size_t> &r) const {
+    for (size_t i = r.begin(); i != r.end(); ++i) {
+      // template stack has been cropped already
+      if (i == templateNumber)
+        continue;
+      // transform the mask
+      irtkRealImage m = reconstructor->GetMask();
+      reconstructor->TransformMask(stacks[i], m, stack_transformations[i]);
+      // Crop template stack
+      reconstructor->CropImage(stacks[i], m);
+    }
+  }
+
+  void operator()() const {
+    task_scheduler_init init(nt);
+    parallel_for(blocked_range<size_t>(0, stacks.size()), *this);
+    init.terminate();
+  }
+};
+
+// Mask is transformed to the all other stacks and they are cropped
+void irtkReconstruction::MaskStacks(vector<irtkRealImage> &stacks,
+    vector<irtkRigidTransformation> &stackTransformations,
+    int templateNumber) {
+  ParallelMaskStacks mask(this, stacks, stackTransformations, templateNumber,
+      _numThreads);
+  mask();
+}
+
 void irtkReconstruction::InvertStackTransformations(
     vector<irtkRigidTransformation> &stackTransformations) {
   for (unsigned int i = 0; i < stackTransformations.size(); i++) {
@@ -538,6 +795,10 @@ irtkRealImage irtkReconstruction::GetMask() {
   return _mask;
 }
 
+irtkRealImage irtkReconstruction::GetReconstructed() {
+  return _reconstructed;
+}
+
 void irtkReconstruction::SetMask(irtkRealImage *mask, double sigma,
     double threshold) {
 
@@ -592,6 +853,34 @@ void irtkReconstruction::SetMask(irtkRealImage *mask, double sigma,
   _haveMask = true;
 }
 
+// Composed affine map from the voxels of an image to the voxels of a mask,
+// i.e. ImageToWorld, Transform and WorldToImage folded into one matrix.
+// Neighbouring voxels differ by a column, so rows are walked with adds.
+class VoxelToMask {
+  double _m[3][4];
+
+  public:
+  VoxelToMask(irtkMatrix imageToWorld, irtkMatrix transformation,
+      irtkMatrix worldToImage) {
+    irtkMatrix m = worldToImage * transformation * imageToWorld;
+    for (int r = 0; r < 3; r++)
+      for (int c = 0; c < 4; c++)
+        _m[r][c] = m(r, c);
+  }
+
+  void Map(int i, int j, int k, double &x, double &y, double &z) const {
+    x = _m[0][0] * i + _m[0][1] * j + _m[0][2] * k + _m[0][3];
+    y = _m[1][0] * i + _m[1][1] * j + _m[1][2] * k + _m[1][3];
+    z = _m[2][0] * i + _m[2][1] * j + _m[2][2] * k + _m[2][3];
+  }
+
+  void Step(int axis, double &x, double &y, double &z) const {
+    x += _m[0][axis];
+    y += _m[1][axis];
+    z += _m[2][axis];
+  }
+};
+
 class ParallelStackRegistrations {
   irtkReconstruction *reconstructor;
   vector<irtkRealImage> &stacks;
@@ -680,30 +969,29 @@ void irtkReconstruction::StackRegistrations(
   // [fetalRecontruction] target needs to be masked before registration
   if (_haveMask) {
     double x, y, z;
-    for (int i = 0; i < target.GetX(); i++)
-      for (int j = 0; j < target.GetY(); j++)
-        for (int k = 0; k < target.GetZ(); k++) {
-          // [fetalRecontruction] image coordinates of the target
-          x = i;
-          y = j;
-          z = k;
-          //[fetalRecontruction] change to world coordinates
-          target.ImageToWorld(x, y, z);
-          // [fetalRecontruction] change to mask image coordinates - 
-          // [fetalRecontruction] mask is aligned with target
-          _mask.WorldToImage(x, y, z);
-          x = round(x);
-          y = round(y);
-          z = round(z);
+    irtkMatrix identity(4, 4);
+    identity.Ident();
+    VoxelToMask map(target.GetImageToWorldMatrix(), identity,
+        _mask.GetWorldToImageMatrix());
+    for (int k = 0; k < target.GetZ(); k++)
+      for (int j = 0; j < target.GetY(); j++) {
+        // [fetalRecontruction] mask image coordinates of the target row - 
+        // [fetalRecontruction] mask is aligned with target
+        map.Map(0, j, k, x, y, z);
+        for (int i = 0; i < target.GetX(); i++, map.Step(0, x, y, z)) {
+          int mx = round(x);
+          int my = round(y);
+          int mz = round(z);
           // [fetalRecontruction] if the voxel is outside mask ROI set it to -1 
           // [fetalRecontruction] (padding value)
-          if ((x >= 0) && (x < _mask.GetX()) && (y >= 0) &&
-              (y < _mask.GetY()) && (z >= 0) && (z < _mask.GetZ())) {
-            if (_mask(x, y, z) == 0)
+          if ((mx >= 0) && (mx < _mask.GetX()) && (my >= 0) &&
+              (my < _mask.GetY()) && (mz >= 0) && (mz < _mask.GetZ())) {
+            if (_mask(mx, my, mz) == 0)
               target(i, j, k) = 0;
           } else
             target(i, j, k) = 0;
         }
+      }
   }
 
   irtkRigidTransformation offset;
@@ -718,6 +1006,62 @@ void irtkReconstruction::StackRegistrations(
   InvertStackTransformations(stackTransformations);
 }
 
+class ParallelStackAverages {
+  vector<irtkRealImage> &stacks;
+  vector<irtkRigidTransformation> &stack_transformations;
+  irtkRealImage &mask;
+  vector<double> &sums;
+  vector<double> &nums;
+  int nt;
+
+  public:
+  ParallelStackAverages(vector<irtkRealImage> &_stacks,
+      vector<irtkRigidTransformation> &_stack_transformations,
+      irtkRealImage &_mask, vector<double> &_sums, vector<double> &_nums,
+      int _nt)
+    : stacks(_stacks), stack_transformations(_stack_transformations),
+    mask(_mask), sums(_sums), nums(_nums) {
+      nt = _nt;
+    }
+
+  void operator()(const blocked_range<size_t> &r) const {
+    for (size_t ind = r.begin(); ind != r.end(); ++ind) {
+      double sum = 0;
+      double num = 0;
+      double x, y, z;
+      // [fetalRecontruction] stack voxel to template (and also _mask) voxel,
+      // [fetalRecontruction] the mask is aligned with template
+      VoxelToMask map(stacks[ind].GetImageToWorldMatrix(),
+          stack_transformations[ind].GetMatrix(), mask.GetWorldToImageMatrix());
+      for (int i = 0; i < stacks[ind].GetX(); i++)
+        for (int j = 0; j < stacks[ind].GetY(); j++) {
+          map.Map(i, j, 0, x, y, z);
+          for (int k = 0; k < stacks[ind].GetZ(); k++, map.Step(2, x, y, z)) {
+            int mx = round(x);
+            int my = round(y);
+            int mz = round(z);
+            // [fetalRecontruction] if the voxel is inside mask ROI include it
+            if ((mx >= 0) && (mx < mask.GetX()) && (my >= 0) &&
+                (my < mask.GetY()) && (mz >= 0) && (mz < mask.GetZ())) {
+              if (mask(mx, my, mz) == 1) {
+                sum += stacks[ind](i, j, k);
+                num++;
+              }
+            }
+          }
+        }
+      sums[ind] = sum;
+      nums[ind] = num;
+    }
+  }
+
+  void operator()() const {
+    task_scheduler_init init(nt);
+    parallel_for(blocked_range<size_t>(0, stacks.size()), *this);
+    init.terminate();
+  }
+};
+
 void irtkReconstruction::MatchStackIntensitiesWithMasking(
     vector<irtkRealImage> &stacks,
     vector<irtkRigidTransformation> &stack_transformations, double averageValue,
@@ -726,53 +1070,24 @@ void irtkReconstruction::MatchStackIntensitiesWithMasking(
     cout << "Matching intensities of stacks. ";
 
   // [fetalRecontruction] Calculate the averages of intensities for all stacks
-  double sum, num;
-  char buffer[256];
   unsigned int ind;
-  int i, j, k;
-  double x, y, z;
+  int i;
   vector<double> stack_average;
-  irtkRealImage m;
 
   // [fetalRecontruction] remember the set average value
   _averageValue = averageValue;
 
   // [fetalRecontruction] averages need to be calculated only in ROI
+  vector<double> sums(stacks.size());
+  vector<double> nums(stacks.size());
+  ParallelStackAverages averages(stacks, stack_transformations, _mask, sums,
+      nums, _numThreads);
+  averages();
+
   for (ind = 0; ind < stacks.size(); ind++) {
-    m = stacks[ind];
-    sum = 0;
-    num = 0;
-    for (i = 0; i < stacks[ind].GetX(); i++)
-      for (j = 0; j < stacks[ind].GetY(); j++)
-        for (k = 0; k < stacks[ind].GetZ(); k++) {
-          // [fetalRecontruction] image coordinates of the stack voxel
-          x = i;
-          y = j;
-          z = k;
-          // [fetalRecontruction] change to world coordinates
-          stacks[ind].ImageToWorld(x, y, z);
-          // [fetalRecontruction] transform to template (and also _mask) space
-          stack_transformations[ind].Transform(x, y, z);
-          // [fetalRecontruction] change to mask image coordinates 
-          // [fetalRecontruction] - mask is aligned with template
-          _mask.WorldToImage(x, y, z);
-          x = round(x);
-          y = round(y);
-          z = round(z);
-          // [fetalRecontruction] if the voxel is inside mask ROI include it
-          if ((x >= 0) && (x < _mask.GetX()) && (y >= 0) &&
-              (y < _mask.GetY()) && (z >= 0) && (z < _mask.GetZ())) {
-            if (_mask(x, y, z) == 1) {
-              m(i, j, k) = 1;
-              sum += stacks[ind](i, j, k);
-              num++;
-            } else
-              m(i, j, k) = 0;
-          }
-        }
     // [fetalRecontruction] calculate average for the stack
-    if (num > 0)
-      stack_average.push_back(sum / num);
+    if (nums[ind] > 0)
+      stack_average.push_back(sums[ind] / nums[ind]);
     else {
       cerr << "Stack " << ind << " has no overlap with ROI" << endl;
       exit(1);
@@ -824,49 +1139,164 @@ void irtkReconstruction::MatchStackIntensitiesWithMasking(
   }
 }
 
+class ParallelCreateSlices {
+  irtkReconstruction *reconstructor;
+  vector<irtkRealImage> &stacks;
+  vector<irtkRigidTransformation> &stack_transformations;
+  vector<double> &thickness;
+  vector<int> &first;
+  int nt;
+  size_t begin;
+  size_t end;
+
+  public:
+  ParallelCreateSlices(irtkReconstruction *_reconstructor,
+      vector<irtkRealImage> &_stacks,
+      vector<irtkRigidTransformation> &_stack_transformations,
+      vector<double> &_thickness, vector<int> &_first, int _nt,
+      size_t _begin, size_t _end)
+    : reconstructor(_reconstructor), stacks(_stacks),
+    stack_transformations(_stack_transformations), thickness(_thickness),
+    first(_first), begin(_begin), end(_end) {
+      nt = _nt;
+    }
+
+  void operator()(const blocked_range<size_t> &r) const {
+    for (size_t i = r.begin(); i != r.end(); ++i) {
+      // [fetalRecontruction] image attributes contain image and voxel size
+      irtkImageAttributes attr = stacks[i].GetImageAttributes();
+      // [fetalRecontruction] attr._z is number of slices in the stack
+      for (int j = 0; j < attr._z; j++) {
+        // [fetalRecontruction] create slice by selecting the appropreate 
+        // [fetalRecontruction] region of the stack
+        irtkRealImage slice =
+          stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
+        // [fetalRecontruction] set correct voxel size in the stack. 
+        // [fetalRecontruction] Z size is equal to slice thickness.
+        slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
+        // [fetalRecontruction] remember the slice
+        int index = first[i] + j;
+        reconstructor->_slices[index] = slice;
+        reconstructor->_simulatedSlices[index] = slice;
+        reconstructor->_simulatedWeights[index] = slice;
+        reconstructor->_simulatedInside[index] = slice;
+        // [fetalRecontruction] remeber stack index for this slice
+        reconstructor->_stackIndex[index] = i;
+        // [fetalRecontruction] initialize slice transformation with 
+        // [fetalRecontruction] the stack transformation
+        reconstructor->_transformations[index] = stack_transformations[i];
+      }
+    }
+  }
+
+  void operator()() const {
+    task_scheduler_init init(nt);
+    parallel_for(blocked_range<size_t>(begin, end), *this);
+    init.terminate();
+  }
+};
+
 void irtkReconstruction::CreateSlicesAndTransformations(
     vector<irtkRealImage> &stacks,
     vector<irtkRigidTransformation> &stack_transformations,
     vector<double> &thickness, const vector<irtkRealImage> &probability_maps) {
 
-  std::vector<uint3> stack_sizes_;
-  uint3 temp;
-
-  // [fetalRecontruction] for each stack
+  // Slices of each stack are appended in stack order
+  vector<int> first(stacks.size());
+  int nSlices = _slices.size();
   for (unsigned int i = 0; i < stacks.size(); i++) {
-    // [fetalRecontruction] image attributes contain image and voxel size
-    irtkImageAttributes attr = stacks[i].GetImageAttributes();
-    temp.x = attr._x;
-    temp.y = attr._y;
-    temp.z = attr._z;
-    stack_sizes_.push_back(temp);
-    // [fetalRecontruction] attr._z is number of slices in the stack
-    for (int j = 0; j < attr._z; j++) {
-      // [fetalRecontruction] create slice by selecting the appropreate 
-      // [fetalRecontruction] region of the stack
-      irtkRealImage slice =
-        stacks[i].GetRegion(0, 0, j, attr._x, attr._y, j + 1);
-      // [fetalRecontruction] set correct voxel size in the stack. 
-      // [fetalRecontruction] Z size is equal to slice thickness.
-      slice.PutPixelSize(attr._dx, attr._dy, thickness[i]);
-      // [fetalRecontruction] remember the slice
-      _slices.push_back(slice);
-      _simulatedSlices.push_back(slice);
-      _simulatedWeights.push_back(slice);
-      _simulatedInside.push_back(slice);
-      // [fetalRecontruction] remeber stack index for this slice
-      _stackIndex.push_back(i);
-      // [fetalRecontruction] initialize slice transformation with 
-      // [fetalRecontruction] the stack transformation
-      _transformations.push_back(stack_transformations[i]);
+    first[i] = nSlices;
+    nSlices += stacks[i].GetZ();
+  }
+
+  _slices.resize(nSlices);
+  _simulatedSlices.resize(nSlices);
+  _simulatedWeights.resize(nSlices);
+  _simulatedInside.resize(nSlices);
+  _stackIndex.resize(nSlices);
+  _transformations.resize(nSlices);
+
+  // Streamed stacks are masked and sent as soon as they are created
+  if (StartStreaming()) {
+    for (unsigned int i = 0; i < stacks.size(); i++) {
+      int last = first[i] + stacks[i].GetZ();
+      ParallelCreateSlices create(this, stacks, stack_transformations,
+          thickness, first, _numThreads, i, i + 1);
+      create();
+      MaskSlices(first[i], last);
+      StreamSlices(first[i], last);
     }
+    return;
   }
+
+  ParallelCreateSlices create(this, stacks, stack_transformations, thickness,
+      first, _numThreads, 0, stacks.size());
+  create();
 }
 
+class ParallelMaskSlices {
+  irtkReconstruction *reconstructor;
+  int nt;
+  size_t first;
+  size_t last;
+
+  public:
+  ParallelMaskSlices(irtkReconstruction *_reconstructor, int _nt,
+      size_t _first, size_t _last)
+    : reconstructor(_reconstructor), first(_first), last(_last) {
+      nt = _nt;
+    }
+
+  void operator()(const blocked_range<size_t> &r) const {
+    irtkRealImage &mask = reconstructor->_mask;
+    double x, y, z;
+    int i, j;
+
+    for (size_t inputIndex = r.begin(); inputIndex != r.end(); ++inputIndex) {
+      irtkRealImage &slice = reconstructor->_slices[inputIndex];
+      // [fetalRecontruction] slice voxel to volume (mask) voxel
+      VoxelToMask map(slice.GetImageToWorldMatrix(),
+          reconstructor->_transformations[inputIndex].GetMatrix(),
+          mask.GetWorldToImageMatrix());
+      for (j = 0; j < slice.GetY(); j++) {
+        map.Map(0, j, 0, x, y, z);
+        for (i = 0; i < slice.GetX(); i++, map.Step(0, x, y, z)) {
+          // [fetalRecontruction] if the value is smaller than 1 assume it is 
+          // padding
+          if (slice(i, j, 0) < 0.01)
+            slice(i, j, 0) = -1;
+          int mx = round(x);
+          int my = round(y);
+          int mz = round(z);
+          // [fetalRecontruction] if the voxel is outside mask ROI set it to 
+          // [fetalRecontruction] -1 (padding value)
+          if ((mx >= 0) && (mx < mask.GetX()) && (my >= 0) && 
+              (my < mask.GetY()) && (mz >= 0) && (mz < mask.GetZ())) {
+            if (mask(mx, my, mz) == 0)
+              slice(i, j, 0) = -1;
+          } else
+            slice(i, j, 0) = -1;
+        }
+      }
+    }
+  }
+
+  void operator()() const {
+    task_scheduler_init init(nt);
+    parallel_for(blocked_range<size_t>(first, last), *this);
+    init.terminate();
+  }
+};
+
 void irtkReconstruction::MaskSlices() {
+  // The streamed slices were masked as they were created
+  if (_streamed)
+    return;
+
+  MaskSlices(0, _slices.size());
+}
 
-  double x, y, z;
-  int i, j;
+void irtkReconstruction::MaskSlices(int first, int last) {
 
   // [fetalRecontruction] Check whether we have a mask
   if (!_haveMask) {
@@ -875,37 +1305,8 @@ void irtkReconstruction::MaskSlices() {
   }
 
   // [fetalRecontruction] mask slices
-  for (int unsigned inputIndex = 0; inputIndex < _slices.size(); inputIndex++) {
-    irtkRealImage &slice = _slices[inputIndex];
-    for (i = 0; i < slice.GetX(); i++)
-      for (j = 0; j < slice.GetY(); j++) {
-        // [fetalRecontruction] if the value is smaller than 1 assume it is 
-        // padding
-        if (slice(i, j, 0) < 0.01)
-          slice(i, j, 0) = -1;
-        // [fetalRecontruction] image coordinates of a slice voxel
-        x = i;
-        y = j;
-        z = 0;
-        // [fetalRecontruction] change to world coordinates in slice space
-        slice.ImageToWorld(x, y, z);
-        // [fetalRecontruction] world coordinates in volume space
-        _transformations[inputIndex].Transform(x, y, z);
-        // [fetalRecontruction] image coordinates in volume space
-        _mask.WorldToImage(x, y, z);
-        x = round(x);
-        y = round(y);
-        z = round(z);
-        // [fetalRecontruction] if the voxel is outside mask ROI set it to 
-        // [fetalRecontruction] -1 (padding value)
-        if ((x >= 0) && (x < _mask.GetX()) && (y >= 0) && (y < _mask.GetY()) &&
-            (z >= 0) && (z < _mask.GetZ())) {
-          if (_mask(x, y, z) == 0)
-            slice(i, j, 0) = -1;
-        } else
-          slice(i, j, 0) = -1;
-      }
-  }
+  ParallelMaskSlices mask(this, _numThreads, first, last);
+  mask();
 }
 
 uint64_t irtkReconstruction::GetTotalBytes() {
@@ -941,108 +1342,754 @@ void irtkReconstruction::ReadTransformation(char *folder) {
   }
 }
 
+class ParallelInitializeEM {
+  irtkReconstruction *reconstructor;
+  int nt;
+
+  public:
+  ParallelInitializeEM(irtkReconstruction *_reconstructor, int _nt)
+    : reconstructor(_reconstructor) {
+      nt = _nt;
+    }
+
+  void operator()(const blocked_range<size_t> &r) const {
+    for (size_t i = r.begin(); i != r.end(); ++i) {
+      // [fetalRecontruction] Create images for voxel weights and bias fields
+      reconstructor->_weights[i] = reconstructor->_slices[i];
+      reconstructor->_bias[i] = reconstructor->_slices[i];
+
+      // [fetalRecontruction] Create and initialize scales
+      reconstructor->_scaleCPU[i] = 1;
+
+      // [fetalRecontruction] Create and initialize slice weights
+      reconstructor->_sliceWeightCPU[i] = 1;
+
+      reconstructor->_slicePotential[i] = 0;
+    }
+  }
+
+  void operator()() const {
+    task_scheduler_init init(nt);
+    parallel_for(blocked_range<size_t>(0, reconstructor->_slices.size()),
+        *this);
+    init.terminate();
+  }
+};
+
 void irtkReconstruction::InitializeEM() {
-  _weights.clear();
-  _bias.clear();
-  _scaleCPU.clear();
-  _sliceWeightCPU.clear();
-  _slicePotential.clear();
+  // Images of a previous subject are reused when their sizes match
+  _weights.resize(_slices.size());
+  _bias.resize(_slices.size());
+  _scaleCPU.resize(_slices.size());
+  _sliceWeightCPU.resize(_slices.size());
+  _slicePotential.resize(_slices.size());
 
-  for (int i = 0; i < _slices.size(); i++) {
-    // [fetalRecontruction] Create images for voxel weights and bias fields
-    _weights.push_back(_slices[i]);
-    _bias.push_back(_slices[i]);
+  ParallelInitializeEM initialize(this, _numThreads);
+  initialize();
+
+  // [fetalRecontruction] Find the range of intensities
+  _maxIntensity = voxel_limits<irtkRealPixel>::min();
+  _minIntensity = voxel_limits<irtkRealPixel>::max();
+  for (unsigned int i = 0; i < _slices.size(); i++) {
+    // [fetalRecontruction] to update minimum we need to exclude padding value
+    irtkRealPixel *ptr = _slices[i].GetPointerToVoxels();
+    for (int ind = 0; ind < _slices[i].GetNumberOfVoxels(); ind++) {
+      if (*ptr > 0) {
+        if (*ptr > _maxIntensity)
+          _maxIntensity = *ptr;
+        if (*ptr < _minIntensity)
+          _minIntensity = *ptr;
+      }
+      ptr++;
+    }
+  }
+}
+
+/*
+ * Must be called before the requests of a phase are sent, since replies can
+ * arrive before Gather() is reached
+ */
+void irtkReconstruction::PrepareGather() {
+  std::lock_guard<std::mutex> l(_m);
+  _received = 0;
+  _pendingReplyCount = 0;
+  _pendingReplies.resize(_numBackendNodes);
+  _future = ebbrt::Promise<int>();
+}
+
+uint64_t irtkReconstruction::Gather(string fn) {
+  auto t = startTimer();
+  auto f = _future.GetFuture();
+  if (_debug)
+    cout << fn << "(): Blocking" << endl;
+
+  f.Block();
+  if (_debug)
+    cout << fn << "(): Returned from future" << endl;
+  auto stop = TimerNow();
+  int phase;
+  {
+    std::lock_guard<std::mutex> l(_m);
+    phase = _gatherPhase;
+  }
+  Trace(TRACE_WAIT, phase, 0, t, stop);
+  return stop - t;
+}
+
+void irtkReconstruction::MaskVolume() {
+  irtkRealPixel *pr = _reconstructed.GetPointerToVoxels();
+  irtkRealPixel *pm = _mask.GetPointerToVoxels();
+  for (int i = 0; i < _reconstructed.GetNumberOfVoxels(); i++) {
+    if (*pm == 0)
+      *pr = -1;
+    pm++;
+    pr++;
+  }
+
+  if (_debug)
+    PrintImageSums("[MaskVolume output]");
+}
+
+void irtkReconstruction::GatherFrontendTimers() {
+  PrintPhasesData("fe", _phase_performance);
+  cout << "fe,migrateSlices,time," << NsToSeconds(_migration.time)
+    << ",wait," << NsToSeconds(_migration.wait) << ",calls,"
+    << _migration.calls << ",sent," << _migration.sent << endl;
+}
+
+// Writes the timers of the front-end and of every back-end, which must have
+// been gathered beforehand
+void irtkReconstruction::WriteTimers(string filename) {
+  ofstream out(filename);
+  if (!out) {
+    cerr << "ERROR: cannot write timers to " << filename << endl;
+    ebbrt::Cpu::Exit(EXIT_FAILURE);
+  }
+
+  WritePhasesHeader(out);
+  WritePhasesData(out, "fe", _phase_performance);
+  WritePhaseData(out, "fe", "migrateSlices", _migration);
+  for (int i = 0; i < (int) _backend_performance.size(); i++)
+    WritePhasesData(out, "be_" + std::to_string(i), _backend_performance[i]);
+}
+
+void irtkReconstruction::WriteTraceEvent(ostream& out,
+    struct trace_event& event, int pid, int64_t offset) {
+  static const char* categories[] = {"phase", "worker", "wait", "send", "recv"};
+  // Microseconds since the front-end started tracing
+  auto ts = ((int64_t) event.begin - offset - (int64_t) _traceOrigin) / 1e3;
+
+  out << ",\n{\"name\":\"" << TracePhaseName(event.phase) << "\",\"cat\":\""
+    << categories[event.type] << "\",\"pid\":" << pid << ",\"tid\":"
+    << event.thread << ",\"ts\":" << ts;
+  if (event.type == TRACE_SEND || event.type == TRACE_RECV) {
+    out << ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"bytes\":" << event.bytes
+      << "}}";
+  } else {
+    out << ",\"ph\":\"X\",\"dur\":" << (event.end - event.begin) / 1e3
+      << "}";
+  }
+}
+
+// Writes the events of the front-end (pid 0) and of every back-end (pid
+// node + 1), which must have been gathered beforehand, as a Chrome trace.
+// Back-end timestamps are moved to the front-end clock.
+void irtkReconstruction::WriteTrace(string filename) {
+  ofstream out(filename);
+  if (!out) {
+    cerr << "ERROR: cannot write trace to " << filename << endl;
+    ebbrt::Cpu::Exit(EXIT_FAILURE);
+  }
+
+  out << fixed << setprecision(3);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+  out << "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+    << "\"args\":{\"name\":\"front-end\"}}";
+  for (int i = 0; i < (int) _backendTrace.size(); i++) {
+    out << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << i + 1
+      << ",\"args\":{\"name\":\"" << BackendName(i) << "\"}}";
+  }
+
+  {
+    std::lock_guard<std::mutex> l(_traceMutex);
+    for (auto& event : _trace)
+      WriteTraceEvent(out, event, 0, 0);
+  }
+  for (int i = 0; i < (int) _backendTrace.size(); i++) {
+    for (auto& event : _backendTrace[i])
+      WriteTraceEvent(out, event, i + 1, _backendClockOffset[i]);
+  }
+
+  out << "\n]}" << endl;
+}
+
+void irtkReconstruction::StartMetrics(string path) {
+  _metricsEnabled = true;
+  _metricsStart = TimerNow();
+  _metrics.Start(path);
+  PublishMetrics();
+}
+
+// Snapshot of the progress, served by the metrics socket until the next one.
+// Called between phases, when no reply is being handled.
+void irtkReconstruction::PublishMetrics() {
+  if (!_metricsEnabled)
+    return;
+
+  std::ostringstream out;
+
+  out << "reconstruction_elapsed_seconds "
+    << NsToSeconds(TimerNow() - _metricsStart) << "\n";
+  out << "reconstruction_outer_iteration " << _outerIteration << "\n";
+  out << "reconstruction_outer_iterations " << _iterations << "\n";
+  out << "reconstruction_inner_iteration " << _innerIteration << "\n";
+  out << "reconstruction_inner_iterations " << _innerIterations << "\n";
+
+  for (int i = 0; i < WORK_PHASES; i++) {
+    auto& p = _phase_performance[i];
+    auto label = "{phase=\"" + PhaseNames[i] + "\"}";
+    out << "reconstruction_phase_seconds" << label << " "
+      << NsToSeconds(p.time) << "\n";
+    out << "reconstruction_phase_wait_seconds" << label << " "
+      << NsToSeconds(p.wait) << "\n";
+    out << "reconstruction_phase_calls" << label << " " << p.calls << "\n";
+  }
+
+  for (int i = 0; i < (int) _nodeMessages.size(); i++) {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    for (auto& m : _nodeMessages[i]) {
+      sent += m.sentBytes;
+      received += m.recvBytes;
+    }
+    auto label = "{node=\"" + BackendName(i) + "\"}";
+    out << "reconstruction_node_sent_bytes" << label << " " << sent << "\n";
+    out << "reconstruction_node_received_bytes" << label << " " << received
+      << "\n";
+  }
+
+  out << "reconstruction_em_sigma " << _sigmaCPU << "\n";
+  out << "reconstruction_em_mix " << _mixCPU << "\n";
+  out << "reconstruction_em_sigma_slice " << _sigmaSCPU << "\n";
+  out << "reconstruction_em_mix_slice " << _mixSCPU << "\n";
+
+  // Cumulative histogram of the slice weights, in tenths
+  vector<int> buckets(11, 0);
+  for (auto w : _sliceWeightCPU) {
+    int b = (int) ceil(w * 10);
+    b = (b < 0) ? 0 : (b > 10) ? 10 : b;
+    buckets[b]++;
+  }
+  int count = 0;
+  for (int b = 0; b <= 10; b++) {
+    count += buckets[b];
+    out << "reconstruction_slice_weight_bucket{le=\"";
+    if (b < 10)
+      out << b / 10.0;
+    else
+      out << "+Inf";
+    out << "\"} " << count << "\n";
+  }
+  out << "reconstruction_slice_weight_count " << _sliceWeightCPU.size()
+    << "\n";
+
+  _metrics.Publish(out.str());
+}
+
+void irtkReconstruction::StopMetrics() {
+  if (_metricsEnabled)
+    _metrics.Stop();
+}
+
+void irtkReconstruction::RequestBackendTimers() {
+
+  _backend_performance.resize(_numBackendNodes);
+  _backendWorkers.resize(_numBackendNodes);
+  _backendMessages.resize(_numBackendNodes);
+  _backendCounters.resize(_numBackendNodes);
+  _backendTrace.resize(_numBackendNodes);
+  _backendClockOffset.resize(_numBackendNodes);
+  _traceRequestTime.resize(_numBackendNodes);
+
+  PrepareGather();
+
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
+    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
+    auto ctxt = cpu_i->get_context();  // context
+
+    ebbrt::event_manager->SpawnRemote([this, i, index]() {
+
+    auto buf = MakeUniqueIOBuf(sizeof(int));
+    auto dp = buf->GetMutDataPointer();
+
+    dp.Get<int>() = GATHER_TIMERS; 
+
+    _totalBytes += buf->ComputeChainDataLength();
+
+    cout << "Sending to network: " << BackendName(i);
+    cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
+    _traceRequestTime[i] = TimerNow();
+    SendToBackend(i, std::move(buf));
+    }, ctxt);
+  }
 
-    // [fetalRecontruction] Create and initialize scales
-    _scaleCPU.push_back(1);
+  Gather("RequestBackendTimers");
+}
+
+void irtkReconstruction::GatherBackendTimers() {
+
+  cout << "In GatherBackendTimers()" << endl;
+
+  RequestBackendTimers();
+
+  auto cnt = 0;
+  for( auto b : _backend_performance){
+    PrintPhasesData("be_"+std::to_string(cnt), b);
+    cnt++;
+  }
+
+  // Hardware counters, only sampled by in-process backends
+  for (int i = 0; i < (int) _backendCounters.size(); i++)
+    PrintCountersData("be_" + std::to_string(i), _backendCounters[i]);
+
+  // Imbalance between the workers of each backend and between all workers
+  vector<worker_phases_data> all;
+  for (int i = 0; i < (int) _backendWorkers.size(); i++) {
+    PrintWorkersData("be_" + std::to_string(i), _backendWorkers[i]);
+    all.insert(all.end(), _backendWorkers[i].begin(), _backendWorkers[i].end());
+  }
+  cout << "be,imbalance,";
+  PrintImbalance(all);
+
+  // Messages as seen from the front-end, per backend, and from each backend
+  PrintMessageHeaders();
+  for (int i = 0; i < (int) _nodeMessages.size(); i++)
+    PrintMessagesData("fe_" + std::to_string(i), _nodeMessages[i]);
+  for (int i = 0; i < (int) _backendMessages.size(); i++)
+    PrintMessagesData("be_" + std::to_string(i), _backendMessages[i]);
+}
+
+/*
+ * Dynamic load balancing functions
+ */
+int irtkReconstruction::NodeIndex(ebbrt::Messenger::NetworkId nid) {
+  auto nidStr = nid.ToString();
+  for (int i = 0; i < (int) _nids.size(); i++) {
+    if (_nids[i].ToString() == nidStr)
+      return i;
+  }
+
+  cerr << "ERROR: unknown backend node " << nidStr << endl;
+  ebbrt::Cpu::Exit(EXIT_FAILURE);
+  return -1;
+}
+
+void irtkReconstruction::InitializeSliceRanges() {
+  int diff = _slices.size();
+  int factor = (int) ceil(diff / (float)(_numBackendNodes));
+
+  _sliceRanges.resize(_numBackendNodes);
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+    int start = i * factor;
+    int end = i * factor + factor;
+    start = (start > diff) ? diff : start;
+    end = (end > diff) ? diff : end;
+    _sliceRanges[i] = make_pair(start, end);
+  }
+
+  // Every backend kernel loops over the unpadded pixels of its slices, so
+  // they are a better estimate of the work than the number of slices
+  _sliceCost.resize(_slices.size());
+  for (int i = 0; i < (int) _slices.size(); i++) {
+    _sliceCost[i] = 0;
+    irtkRealPixel *ptr = _slices[i].GetPointerToVoxels();
+    for (int j = 0; j < _slices[i].GetNumberOfVoxels(); j++) {
+      if (*ptr != -1)
+        _sliceCost[i]++;
+      ptr++;
+    }
+  }
+
+  _backendBusy.assign(_numBackendNodes, 0.0);
+}
+
+vector<pair<int, int>> irtkReconstruction::ComputeSliceRanges(
+    vector<double>& speed) {
+  int nSlices = _slices.size();
+  int nNodes = speed.size();
+
+  double totalCost = 0;
+  for (int i = 0; i < nSlices; i++)
+    totalCost += _sliceCost[i];
+
+  double totalSpeed = 0;
+  for (int i = 0; i < nNodes; i++)
+    totalSpeed += speed[i];
+
+  // Slices stay contiguous so that backends keep addressing them by a
+  // [start, end) range. Each node gets a share of the work proportional to
+  // its speed and at least one slice, so that it can still be measured.
+  vector<pair<int, int>> ranges(nNodes);
+  int slice = 0;
+  double cost = 0;
+  double boundary = 0;
+  for (int i = 0; i < nNodes; i++) {
+    boundary += totalCost * speed[i] / totalSpeed;
+    int start = slice;
+    int remainingNodes = nNodes - i - 1;
+    while (slice < nSlices - remainingNodes) {
+      bool lastNode = remainingNodes == 0;
+      if (!lastNode && slice > start &&
+          cost + 0.5 * _sliceCost[slice] > boundary)
+        break;
+      cost += _sliceCost[slice];
+      slice++;
+    }
+    ranges[i] = make_pair(start, slice);
+  }
+
+  return ranges;
+}
+
+void irtkReconstruction::MigrateSlices(vector<pair<int, int>>& ranges) {
+
+  auto start = startTimer();
+
+  PrepareGather();
+
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
+    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
+    auto ctxt = cpu_i->get_context();  // context
+
+    auto oldRange = _sliceRanges[i];
+    auto newRange = ranges[i];
+
+    ebbrt::event_manager->SpawnRemote([this, i, index, oldRange, newRange]() {
+
+    // Only the slices that the node does not hold yet are sent. Their weights
+    // and bias are set by InitializeEMValues() on the next CoeffInit, before
+    // they are read
+    vector<int> incoming;
+    for (int j = newRange.first; j < newRange.second; j++) {
+      if ((j < oldRange.first) || (j >= oldRange.second))
+        incoming.push_back(j);
+    }
+
+    auto buf = MakeUniqueIOBuf(4 * sizeof(int));
+    auto dp = buf->GetMutDataPointer();
+
+    dp.Get<int>() = REBALANCE;
+    dp.Get<int>() = newRange.first;
+    dp.Get<int>() = newRange.second;
+    dp.Get<int>() = incoming.size();
+
+    for (auto j : incoming) {
+      auto sliceIndex = MakeUniqueIOBuf(sizeof(int));
+      auto sdp = sliceIndex->GetMutDataPointer();
+      sdp.Get<int>() = j;
 
-    // [fetalRecontruction] Create and initialize slice weights
-    _sliceWeightCPU.push_back(1);
+      buf->PrependChain(std::move(sliceIndex));
+      buf->PrependChain(std::move(serializeImage(_slices[j])));
+    }
+
+    // Transformations were updated by SliceToVolumeRegistration()
+    buf->PrependChain(std::move(serializeTransformations(newRange.first, 
+            newRange.second, _transformations)));
+
+    cout << "Sending to network: " << BackendName(i);
+    cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
+    _migration.sent += buf->ComputeChainDataLength();
+    SendToBackend(i, std::move(buf));
+    }, ctxt);
+  }
+
+  _migration.wait += Gather("MigrateSlices");
+
+  _sliceRanges = ranges;
+
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _migration.time += stop - start;
+  _migration.calls++;
+  Trace(TRACE_PHASE, REBALANCE, 0, start, stop);
+
+  if (_debug)
+    cout << "[MigrateSlices time] " << seconds << endl;
+}
+
+// Seconds the backend spent in phases, as of the last RequestBackendTimers()
+double irtkReconstruction::BackendBusy(int node) {
+  double total = 0;
+  for (auto p : _backend_performance[node])
+    total += NsToSeconds(p.time);
+  return total;
+}
+
+/*
+ * The first window measured by Rebalance() starts after the bootstrap, whose
+ * deserialization and first coefficients would skew the per-node estimate
+ */
+void irtkReconstruction::StartRebalanceWindow() {
+
+  if (!_rebalance || _numBackendNodes < 2)
+    return;
+
+  RequestBackendTimers();
+
+  for (int i = 0; i < (int) _numBackendNodes; i++)
+    _backendBusy[i] = BackendBusy(i);
+}
+
+void irtkReconstruction::Rebalance() {
+
+  if (!_rebalance || _numBackendNodes < 2)
+    return;
+
+  RequestBackendTimers();
+
+  int nNodes = _numBackendNodes;
+  vector<double> busy(nNodes);
+  vector<double> speed(nNodes);
+  double maxBusy = 0;
+  double meanBusy = 0;
+
+  for (int i = 0; i < nNodes; i++) {
+    // Time spent computing since the last rebalance
+    double total = BackendBusy(i);
+    busy[i] = total - _backendBusy[i];
+    _backendBusy[i] = total;
+
+    double work = 0;
+    for (int j = _sliceRanges[i].first; j < _sliceRanges[i].second; j++)
+      work += _sliceCost[j];
+
+    if ((busy[i] <= 0) || (work <= 0)) {
+      cout << "[Rebalance] no timings for node " << i << ", skipping" << endl;
+      return;
+    }
+    speed[i] = work / busy[i];
+
+    maxBusy = (busy[i] > maxBusy) ? busy[i] : maxBusy;
+    meanBusy += busy[i] / nNodes;
+  }
+
+  double imbalance = maxBusy / meanBusy - 1;
+
+  if (_debug) {
+    for (int i = 0; i < nNodes; i++)
+      cout << "[Rebalance input] node " << i << ": slices [" 
+        << _sliceRanges[i].first << ", " << _sliceRanges[i].second 
+        << ") busy " << busy[i] << endl;
+    cout << "[Rebalance input] imbalance: " << imbalance << endl;
+  }
+
+  if (imbalance < _rebalanceThreshold)
+    return;
+
+  auto ranges = ComputeSliceRanges(speed);
+  if (ranges == _sliceRanges)
+    return;
+
+  cout << "[Rebalance] imbalance " << imbalance << ", new slice ranges:";
+  for (int i = 0; i < nNodes; i++)
+    cout << " [" << ranges[i].first << ", " << ranges[i].second << ")";
+  cout << endl;
+
+  MigrateSlices(ranges);
+}
+
+/*
+ * The checkpoint holds the volume, mask, slice transformations and the scalars
+ * carried from one outer iteration to the next, in the format of the messages
+ * sent to the backends. The slices are created again from the input stacks,
+ * and the per-slice EM values are not saved since every outer iteration
+ * starts them again from InitializeEMValues().
+ */
+void irtkReconstruction::WriteCheckpoint(int iteration) {
+  auto start = startTimer();
+
+  struct checkpointParameters parameters;
+  parameters.version = 2;
+  parameters.iteration = iteration;
+  parameters.slices = _slices.size();
+  parameters.delta = _delta;
+  parameters.lambda = _lambda;
+  parameters.alpha = _alpha;
+  parameters.sigmaCPU = _sigmaCPU;
+  parameters.sigmaSCPU = _sigmaSCPU;
+  parameters.sigmaS2CPU = _sigmaS2CPU;
+  parameters.mixCPU = _mixCPU;
+  parameters.mixSCPU = _mixSCPU;
+  parameters.mCPU = _mCPU;
+  parameters.maxIntensity = _maxIntensity;
+  parameters.minIntensity = _minIntensity;
 
-    _slicePotential.push_back(0);
-  }
+  auto buf = MakeUniqueIOBuf(sizeof(struct checkpointParameters));
+  auto mdp = buf->GetMutDataPointer();
+  mdp.Get<struct checkpointParameters>() = parameters;
 
-  // [fetalRecontruction] Find the range of intensities
-  _maxIntensity = voxel_limits<irtkRealPixel>::min();
-  _minIntensity = voxel_limits<irtkRealPixel>::max();
-  for (unsigned int i = 0; i < _slices.size(); i++) {
-    // [fetalRecontruction] to update minimum we need to exclude padding value
-    irtkRealPixel *ptr = _slices[i].GetPointerToVoxels();
-    for (int ind = 0; ind < _slices[i].GetNumberOfVoxels(); ind++) {
-      if (*ptr > 0) {
-        if (*ptr > _maxIntensity)
-          _maxIntensity = *ptr;
-        if (*ptr < _minIntensity)
-          _minIntensity = *ptr;
-      }
-      ptr++;
-    }
-  }
-}
+  buf->PrependChain(std::move(serializeImage(_reconstructed)));
+  buf->PrependChain(std::move(serializeImage(_mask)));
+  buf->PrependChain(std::move(serializeTransformations(_transformations)));
 
-float irtkReconstruction::Gather(string fn) {
-  auto t = startTimer();
-  _future = ebbrt::Promise<int>();
-  auto f = _future.GetFuture();
-  if (_debug)
-    cout << fn << "(): Blocking" << endl;
+  // Not part of any message
+  TakeSerializeTime();
 
-  f.Block();
-  if (_debug)
-    cout << fn << "(): Returned from future" << endl;
-  return endTimer(t);
-}
+  auto len = buf->ComputeChainDataLength();
+  vector<uint8_t> data(len);
+  auto dp = buf->GetDataPointer();
+  dp.Get(len, data.data());
 
-void irtkReconstruction::MaskVolume() {
-  irtkRealPixel *pr = _reconstructed.GetPointerToVoxels();
-  irtkRealPixel *pm = _mask.GetPointerToVoxels();
-  for (int i = 0; i < _reconstructed.GetNumberOfVoxels(); i++) {
-    if (*pm == 0)
-      *pr = -1;
-    pm++;
-    pr++;
+  // Replace the previous checkpoint only once this one is complete. A run
+  // that cannot save its progress stops, the previous checkpoint is kept to
+  // resume from.
+  string tmpName = _checkpointName + ".tmp";
+  ofstream out(tmpName, ios::binary);
+  out.write(reinterpret_cast<const char *>(data.data()), len);
+  out.close();
+  if (!out || rename(tmpName.c_str(), _checkpointName.c_str()) != 0) {
+    remove(tmpName.c_str());
+    cerr << "ERROR: cannot write checkpoint " << _checkpointName << endl;
+    exit(EXIT_FAILURE);
   }
 
-  if (_debug)
-    PrintImageSums("[MaskVolume output]");
-}
-
-void irtkReconstruction::GatherFrontendTimers() {
-  PrintPhasesData("fe", _phase_performance);
+  cout << "[Checkpoint] iteration " << iteration << " saved to "
+    << _checkpointName << " (" << len << " bytes, " << endTimer(start)
+    << " s)" << endl;
 }
 
-void irtkReconstruction::GatherBackendTimers() {
+/*
+ * Restores the state saved by WriteCheckpoint() and returns the outer
+ * iteration to start from. A --resume run stops if the checkpoint cannot be
+ * used.
+ */
+int irtkReconstruction::ReadCheckpoint() {
+  ifstream in(_checkpointName, ios::binary | ios::ate);
+  if (!in) {
+    cerr << "ERROR: cannot open checkpoint " << _checkpointName << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  size_t len = in.tellg();
+  in.seekg(0);
+  auto buf = MakeUniqueIOBuf(len);
+  in.read(reinterpret_cast<char *>(buf->MutData()), len);
+  if (!in || len < sizeof(struct checkpointParameters)) {
+    cerr << "ERROR: cannot read checkpoint " << _checkpointName << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  auto deserializeStart = DeserializeTime();
+  auto dp = buf->GetDataPointer();
+  auto parameters = dp.Get<struct checkpointParameters>();
+
+  if (parameters.version != 2 || parameters.slices != (int) _slices.size() ||
+      parameters.iteration <= 0 || parameters.iteration >= _iterations) {
+    cerr << "ERROR: checkpoint " << _checkpointName << " was saved at "
+      << "iteration " << parameters.iteration << " with "
+      << parameters.slices << " slices, this run has " << _iterations
+      << " iterations and " << _slices.size() << " slices" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  _delta = parameters.delta;
+  _lambda = parameters.lambda;
+  _alpha = parameters.alpha;
+  _sigmaCPU = parameters.sigmaCPU;
+  _sigmaSCPU = parameters.sigmaSCPU;
+  _sigmaS2CPU = parameters.sigmaS2CPU;
+  _mixCPU = parameters.mixCPU;
+  _mixSCPU = parameters.mixSCPU;
+  _mCPU = parameters.mCPU;
+  _maxIntensity = parameters.maxIntensity;
+  _minIntensity = parameters.minIntensity;
+
+  deserializeSlice(dp, _reconstructed);
+  deserializeSlice(dp, _mask);
+
+  auto nRigidTrans = dp.Get<int>();
+  _transformations.resize(nRigidTrans);
+  for (int i = 0; i < nRigidTrans; i++)
+    deserializeTransformations(dp, _transformations[i]);
 
-  cout << "In GatherBackendTimers()" << endl;
+  DeserializeTime() = deserializeStart;
 
-  for (int i = 0; i < (int) _numBackendNodes; i++) {
+  cout << "[Checkpoint] resuming at iteration " << parameters.iteration
+    << " from " << _checkpointName << endl;
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
-    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
-    auto ctxt = cpu_i->get_context();  // context
+  return parameters.iteration;
+}
 
-    ebbrt::event_manager->SpawnRemote([this, i, index]() {
+/*
+ * Backends only receive the slices in the CoeffInit() of the first
+ * iteration. When resuming, send them the restored state the same way so
+ * that SliceToVolumeRegistration() can run. The backends do not compute
+ * coefficients nor answer, the CoeffInit() of the resumed iteration follows.
+ */
+void irtkReconstruction::ResumeBackends() {
+  CoeffInitBootstrap(createCoeffInitParameters(), COEFF_INIT_RESUME);
+}
 
-    auto buf = MakeUniqueIOBuf(sizeof(int));
-    auto dp = buf->GetMutDataPointer();
+/*
+ * Coarse-to-fine schedule: the first _coarseIterations outer iterations
+ * reconstruct on a grid _coarseFactor times coarser than the template, so
+ * that the volume, the coefficients and the slice-to-volume registrations are
+ * cheaper. The volume is resampled between the grids and the mask of the
+ * template is kept to resample from. The backends receive the new grid with
+ * the next bootstrap or slice-to-volume registration.
+ */
+void irtkReconstruction::SetGrid(bool coarse) {
+  if (coarse == _coarse)
+    return;
 
-    dp.Get<int>() = GATHER_TIMERS; 
+  irtkImageAttributes attr;
+  if (coarse) {
+    _fineMask = _mask;
+    attr = _reconstructed.GetImageAttributes();
+    // IRTK keeps the origin at the centre, the grids cover the same extent
+    attr._x = max(1, (int) ceil(attr._x / _coarseFactor));
+    attr._y = max(1, (int) ceil(attr._y / _coarseFactor));
+    attr._z = max(1, (int) ceil(attr._z / _coarseFactor));
+    attr._dx *= _coarseFactor;
+    attr._dy *= _coarseFactor;
+    attr._dz *= _coarseFactor;
+  } else {
+    attr = _fineMask.GetImageAttributes();
+  }
 
-    _totalBytes += buf->ComputeChainDataLength();
+  irtkRealImage volume(attr);
+  irtkRigidTransformation transformation;
+  irtkImageTransformation imagetransformation;
+  irtkLinearInterpolateImageFunction interpolator;
+  imagetransformation.SetInput(&_reconstructed, &transformation);
+  imagetransformation.SetOutput(&volume);
+  imagetransformation.PutTargetPaddingValue(-1);
+  imagetransformation.PutSourcePaddingValue(0);
+  imagetransformation.PutInterpolator(&interpolator);
+  imagetransformation.Run();
+  _reconstructed = volume;
 
-    cout << "Sending to network: " << _nids[i].ToString();
-    cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
-    SendMessage(_nids[i], std::move(buf));
-    }, ctxt);
+  if (coarse) {
+    irtkNearestNeighborInterpolateImageFunction nn;
+    _mask.Initialize(attr);
+    imagetransformation.SetInput(&_fineMask, &transformation);
+    imagetransformation.SetOutput(&_mask);
+    imagetransformation.PutInterpolator(&nn);
+    imagetransformation.Run();
+  } else {
+    _mask = _fineMask;
   }
 
-  Gather("GatherBackendTimers");
+  cout << "[Grid] " << attr._x << "x" << attr._y << "x" << attr._z << " "
+    << attr._dx << "mm" << endl;
 
-  auto cnt = 0;
-  for( auto b : _backend_performance){
-    PrintPhasesData("be_"+std::to_string(cnt), b);
-    cnt++;
-  }
+  _coarse = coarse;
+  _gridChanged = true;
 }
 
 void irtkReconstruction::Execute() {
@@ -1051,17 +2098,32 @@ void irtkReconstruction::Execute() {
   auto start = startTimer();
 
   int recIterations;
+  int firstIteration = 0;
 
-  for (int it = 0; it < _iterations; it++) {
+  if (_resume)
+    firstIteration = ReadCheckpoint();
+
+  for (int it = firstIteration; it < _iterations; it++) {
     if (_debug)
       cout << "[Iteration " << it << "] " << endl;
 
+    _outerIteration = it;
+    _innerIteration = 0;
+    PublishMetrics();
+
+    auto lastIteration = it == (_iterations - 1);
+
+    SetGrid(it < _coarseIterations && !lastIteration);
+
     if (it > 0) {
+      if (it == firstIteration)
+        ResumeBackends();
       SliceToVolumeRegistration();
+      // A resumed run has no window to measure before its first iteration
+      if (it > firstIteration)
+        Rebalance();
     }
 
-    auto lastIteration = it == (_iterations - 1);
-
     if (lastIteration) {
       SetSmoothingParameters(_lastIterLambda);
     } else {
@@ -1075,6 +2137,7 @@ void irtkReconstruction::Execute() {
 
     // Use faster reconstruction for iterations, slower for final reconstruction
     _qualityFactor = lastIteration ? 2 : 1;
+    _psfRadius = lastIteration ? 0 : _analyticPSF;
 
     InitializeEMValues();
 
@@ -1082,6 +2145,9 @@ void irtkReconstruction::Execute() {
 
     GaussianReconstruction();
 
+    if (it == firstIteration)
+      StartRebalanceWindow();
+
     SimulateSlices(true);
 
     InitializeRobustStatistics();
@@ -1094,7 +2160,11 @@ void irtkReconstruction::Execute() {
     else
       recIterations = _recIterationsFirst;
 
-    for (int recIt = 0; recIt < recIterations; recIt++) {
+    _innerIterations = recIterations;
+    PublishMetrics();
+
+    int recIt;
+    for (recIt = 0; recIt < recIterations; recIt++) {
 
       if (_debug) {
         cout << "[Reconstruction iteration " << recIt << "]" << endl;
@@ -1127,8 +2197,17 @@ void irtkReconstruction::Execute() {
       MStep(recIt + 1);
 
       EStep();
-    
+
+      _innerIteration = recIt + 1;
+      PublishMetrics();
+
+      if (_convergence > 0 && _reconstructionChange < _convergence) {
+        recIt++;
+        break;
+      }
     }
+    cout << "[Iteration " << it << " reconstruction iterations] " << recIt 
+      << endl;
     if (_debug) {
       cout << endl;
       PrintImageSums("[End of inner loop]");
@@ -1136,6 +2215,13 @@ void irtkReconstruction::Execute() {
     
     MaskVolume();
     // TODO: Do we need to implement Evaluate()
+
+    if (!_intermediatesFolder.empty())
+      WriteIntermediates(it);
+
+    // The last iteration is followed by backend phases, resume before it
+    if (!_checkpointName.empty() && it + 1 < _iterations)
+      WriteCheckpoint(it + 1);
   }
 
   RestoreSliceIntensities();
@@ -1150,11 +2236,50 @@ void irtkReconstruction::Execute() {
     cout << "[End of outer loop time] " << seconds << endl;
   }
 
-  _reconstructed.Write(_outputName.c_str());
+  _writer.Write(_reconstructed, _outputName);
 
   _reconstructionDone.SetValue();
 }
 
+/*
+ * Volume, slice weights and slice transformations at the end of an outer
+ * iteration
+ */
+void irtkReconstruction::WriteIntermediates(int iteration) {
+  string prefix = _intermediatesFolder + "/";
+  string suffix = to_string(iteration);
+
+  _writer.Write(_reconstructed, prefix + "reconstructed" + suffix + ".nii.gz");
+
+  auto weights = _sliceWeightCPU;
+  auto transformations = _transformations;
+  _writer.Submit([prefix, suffix, weights, transformations]() mutable {
+    string weightsName = prefix + "sliceWeights" + suffix + ".txt";
+    ofstream out(weightsName);
+    for (auto weight : weights)
+      out << weight << endl;
+    if (!out) {
+      cerr << "ERROR: cannot write " << weightsName << endl;
+      return false;
+    }
+
+    for (int i = 0; i < (int) transformations.size(); i++) {
+      string name = prefix + "transformation" + suffix + "_" + to_string(i) +
+        ".dof";
+      transformations[i].Write((char *) name.c_str());
+    }
+    return true;
+  });
+}
+
+// Failed writes of the background writer end the run here
+void irtkReconstruction::WaitForOutput() {
+  if (!_writer.Wait()) {
+    cerr << "ERROR: some output files could not be written" << endl;
+    ebbrt::Cpu::Exit(EXIT_FAILURE);
+  }
+}
+
 struct coeffInitParameters irtkReconstruction::createCoeffInitParameters() {
   struct coeffInitParameters parameters;
   parameters.debug = _debug;
@@ -1164,6 +2289,7 @@ struct coeffInitParameters irtkReconstruction::createCoeffInitParameters() {
   parameters.lambda = _lambda;
   parameters.alpha = _alpha;
   parameters.qualityFactor = _qualityFactor;
+  parameters.psfRadius = _psfRadius;
 
   return parameters;
 }
@@ -1174,6 +2300,7 @@ irtkReconstruction::CreateReconstructionParameters(int start, int end) {
 
   parameters.globalBiasCorrection = _globalBiasCorrection;
   parameters.adaptive = _adaptive;
+  parameters.trace = _traceEnabled;
   parameters.sigmaBias = _sigmaBias;
   parameters.step = _step;
   parameters.sigmaSCPU = _sigmaSCPU;
@@ -1182,6 +2309,7 @@ irtkReconstruction::CreateReconstructionParameters(int start, int end) {
   parameters.mixCPU = _mixCPU;
   parameters.lowIntensityCutoff = _lowIntensityCutoff;
   parameters.numThreads = _numThreads;
+  parameters.psfSubdivisions = _psfSubdivisions;
   parameters.start = start;
   parameters.end = end;
 
@@ -1193,28 +2321,25 @@ irtkReconstruction::CreateReconstructionParameters(int start, int end) {
 }
 
 void irtkReconstruction::CoeffInitBootstrap(
-    struct coeffInitParameters parameters) {
+    struct coeffInitParameters parameters, int mode) {
 
   cout << "In CoeffInitBootstrap()" << endl;
 
   auto startTime = startTimer();
 
-  int diff = _slices.size();
-  int factor = (int) ceil(diff / (float)(_numBackendNodes));
-  int start;
-  int end;
+  InitializeSliceRanges();
 
   for (int i = 0; i < (int) _numBackendNodes; i++) {
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
-    start = i * factor;
-    end = i * factor + factor;
-    end = (end > diff) ? diff : end;
+    int start = _sliceRanges[i].first;
+    int end = _sliceRanges[i].second;
 
-    ebbrt::event_manager->SpawnRemote([this, i, index, start, end, parameters]() {
+    ebbrt::event_manager->SpawnRemote(
+        [this, i, index, start, end, parameters, mode]() {
 
     auto buf = MakeUniqueIOBuf((2 * sizeof(int)) +
         sizeof(struct coeffInitParameters) +
@@ -1222,7 +2347,7 @@ void irtkReconstruction::CoeffInitBootstrap(
     auto dp = buf->GetMutDataPointer();
 
     dp.Get<int>() = COEFF_INIT;
-    dp.Get<int>() = 1;
+    dp.Get<int>() = mode;
     dp.Get<struct coeffInitParameters>() = parameters;
 
     auto reconstructionParameters = CreateReconstructionParameters(start, end);
@@ -1243,42 +2368,44 @@ void irtkReconstruction::CoeffInitBootstrap(
     buf->PrependChain(std::move(sf));
     buf->PrependChain(std::move(si));
 
-    _received = 0;
-
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[COEFF_INIT].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    // The resumed state is not answered, the next CoeffInit is
+    SendToBackend(i, std::move(buf), mode != COEFF_INIT_RESUME);
     }, ctxt);
   }
+
+  _gridChanged = false;
 }
 
 
-void irtkReconstruction::CoeffInit(struct coeffInitParameters parameters) {
+void irtkReconstruction::CoeffInit(struct coeffInitParameters parameters,
+    int mode) {
   auto start = startTimer();
 
   cout << "In CoeffInit([params])" << endl;
 
   for (int i = 0; i < (int) _numBackendNodes; i++) {
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
-    ebbrt::event_manager->SpawnRemote([this, i, parameters, index]() {
+    ebbrt::event_manager->SpawnRemote([this, i, parameters, index, mode]() {
 
     auto buf = MakeUniqueIOBuf((2 * sizeof(int)) + 
         sizeof(struct coeffInitParameters));
     auto dp = buf->GetMutDataPointer();
 
     dp.Get<int>() = COEFF_INIT; 
-    dp.Get<int>() = 0;
+    dp.Get<int>() = mode;
     dp.Get<struct coeffInitParameters>() = parameters;
 
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[COEFF_INIT].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 }
@@ -1290,12 +2417,132 @@ void irtkReconstruction::CoeffInit(int iteration) {
   auto parameters = createCoeffInitParameters();
   bool initialize = iteration == 0;
 
-  if (initialize)
+  // Backends answer with GaussianReconstruction() results
+  _voxelNum.resize(_slices.size());
+  _reconstructed = 0;
+  _volumeWeights.Initialize(_reconstructed.GetImageAttributes());
+  _volumeWeights = 0;
+
+  PrepareGather();
+
+  if (initialize && _streamed) {
+    // The slice costs need the slices, which did not exist when streaming
+    // started. The ranges are the same.
+    InitializeSliceRanges();
+    CoeffInit(parameters, COEFF_INIT_STREAM_END);
+  }
+  else if (initialize)
     CoeffInitBootstrap(parameters);
   else
     CoeffInit(parameters);
 }
 
+/*
+ * Bootstraps the backends with the volume and the mask only, the slices then
+ * follow one stack at a time from CreateSlicesAndTransformations(), so that
+ * the backends compute the coefficients of the first stacks while the next
+ * ones are created. The CoeffInit() of the first iteration only sends its
+ * parameters. Returns false, and sends nothing, if the slices are not
+ * streamed or the backends are not allocated yet.
+ */
+bool irtkReconstruction::StartStreaming() {
+  if (!_streamSlices || _resume || !_backendsReady)
+    return false;
+
+  cout << "In StartStreaming()" << endl;
+
+  // The PSF of the first iteration, see Execute()
+  _qualityFactor = (_iterations == 1) ? 2 : 1;
+  _psfRadius = (_iterations == 1) ? 0 : _analyticPSF;
+  SetGrid(_coarseIterations > 0 && _iterations > 1);
+  auto parameters = createCoeffInitParameters();
+
+  // The slices are not created yet, only their number is known
+  InitializeSliceRanges();
+
+  // Only the geometry of the volume is used, and Execute() clears it
+  auto reconstructed = std::make_shared<irtkRealImage>(_reconstructed);
+
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
+    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
+    auto ctxt = cpu_i->get_context();  // context
+
+    int start = _sliceRanges[i].first;
+    int end = _sliceRanges[i].second;
+
+    ebbrt::event_manager->SpawnRemote(
+        [this, i, start, end, parameters, reconstructed]() {
+
+    auto buf = MakeUniqueIOBuf((2 * sizeof(int)) +
+        sizeof(struct coeffInitParameters) +
+        sizeof(struct reconstructionParameters) + sizeof(int));
+    auto dp = buf->GetMutDataPointer();
+
+    dp.Get<int>() = COEFF_INIT;
+    dp.Get<int>() = COEFF_INIT_STREAM_START;
+    dp.Get<struct coeffInitParameters>() = parameters;
+    dp.Get<struct reconstructionParameters>() =
+      CreateReconstructionParameters(start, end);
+    dp.Get<int>() = _slices.size();
+
+    auto sf = std::make_unique<StaticIOBuf>(
+        reinterpret_cast<const uint8_t *>(_stackFactor.data()),
+        (size_t)(_stackFactor.size() * sizeof(float)));
+
+    buf->PrependChain(std::move(serializeImage(*reconstructed)));
+    buf->PrependChain(std::move(serializeImage(_mask)));
+    buf->PrependChain(std::move(sf));
+
+    _phase_performance[COEFF_INIT].sent += buf->ComputeChainDataLength();
+    SendToBackend(i, std::move(buf), false);
+    }, ctxt);
+  }
+
+  _streamed = true;
+  _gridChanged = false;
+  return true;
+}
+
+// Sends the slices [first, last) of a stack to the backends that hold them
+void irtkReconstruction::StreamSlices(int first, int last) {
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+    int start = max(first, _sliceRanges[i].first);
+    int end = min(last, _sliceRanges[i].second);
+    if (start >= end)
+      continue;
+
+    auto index = _backendCpus[i];   // get the cpu index
+    auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
+    auto ctxt = cpu_i->get_context();  // context
+
+    ebbrt::event_manager->SpawnRemote([this, i, start, end]() {
+
+    auto buf = MakeUniqueIOBuf(4 * sizeof(int));
+    auto dp = buf->GetMutDataPointer();
+    dp.Get<int>() = COEFF_INIT;
+    dp.Get<int>() = COEFF_INIT_STREAM_SLICES;
+    dp.Get<int>() = start;
+    dp.Get<int>() = end;
+
+    auto si = std::make_unique<StaticIOBuf>(
+        reinterpret_cast<const uint8_t *>(_stackIndex.data() + start),
+        (size_t)((end - start) * sizeof(int)));
+
+    buf->PrependChain(std::move(serializeSlices(start, end, _slices)));
+    buf->PrependChain(std::move(
+          serializeTransformations(start, end, _transformations)));
+    buf->PrependChain(std::move(si));
+
+    cout << "Streaming slices [" << start << ", " << end << ") to "
+      << BackendName(i) << endl;
+    _phase_performance[COEFF_INIT].sent += buf->ComputeChainDataLength();
+    SendToBackend(i, std::move(buf), false);
+    }, ctxt);
+  }
+}
+
 void irtkReconstruction::ExcludeSlicesWithOverlap() {
   vector<int> voxelNumTmp;
   for (int i = 0; i < (int) _voxelNum.size(); i++) {
@@ -1317,11 +2564,6 @@ void irtkReconstruction::GaussianReconstruction() {
 
   auto start = startTimer();
 
-  _voxelNum.resize(_slices.size());
-  _reconstructed = 0;
-  _volumeWeights.Initialize(_reconstructed.GetImageAttributes());
-  _volumeWeights = 0;
-
   _phase_performance[GAUSSIAN_RECONSTRUCTION].wait +=
       Gather("CoeffInit & GaussianReconstruction");
 
@@ -1329,8 +2571,11 @@ void irtkReconstruction::GaussianReconstruction() {
 
   ExcludeSlicesWithOverlap();
 
-  auto seconds = endTimer(start);
-  _phase_performance[GAUSSIAN_RECONSTRUCTION].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].time += stop - start;
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].calls++;
+  Trace(TRACE_PHASE, GAUSSIAN_RECONSTRUCTION, 0, start, stop);
 
   if (_debug) {
     PrintImageSums("[GaussianReconstruction output]");
@@ -1345,9 +2590,23 @@ void irtkReconstruction::SimulateSlices(bool initialize) {
 
   cout << "In SimulateSlices()" << endl;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  // Backends answer with InitializeRobustStatistics() or MStep() results
+  if (initialize) {
+    _sigmaSum = 0;
+    _numSum = 0;
+  } else {
+    _mSigma = 0.0;
+    _mMix = 0.0;
+    _mMin = 0.0;
+    _mMax = 0.0;
+    _mNum = 0.0;
+  }
+
+  PrepareGather();
+
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1360,10 +2619,10 @@ void irtkReconstruction::SimulateSlices(bool initialize) {
     dp.Get<int>() = (int) initialize;
     buf->PrependChain(std::move(serializeSlice(_reconstructed)));
 
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[SIMULATE_SLICES].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 }
@@ -1372,12 +2631,6 @@ void irtkReconstruction::MStep(int iteration) {
 
   auto start = startTimer();
 
-  _mSigma = 0.0;
-  _mMix = 0.0;
-  _mMin = 0.0;
-  _mMax = 0.0;
-  _mNum = 0.0;
-
   _phase_performance[M_STEP].wait += Gather("Simulate Slices & MStep");
 
   if (_mMix > 0) {
@@ -1395,8 +2648,11 @@ void irtkReconstruction::MStep(int iteration) {
 
   _mCPU = 1 / (_mMax - _mMin);
 
-  auto seconds = endTimer(start);
-  _phase_performance[M_STEP].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[M_STEP].time += stop - start;
+  _phase_performance[M_STEP].calls++;
+  Trace(TRACE_PHASE, M_STEP, 0, start, stop);
 
   if (_debug) {
     cout << "[MStep output] _sigmaCPU: " << _sigmaCPU << endl;
@@ -1412,9 +2668,15 @@ void irtkReconstruction::RestoreSliceIntensities() {
 
   auto start = startTimer();
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  // Backends answer with ScaleVolume() results
+  _num = 0;
+  _den = 0;
+
+  PrepareGather();
+
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1425,10 +2687,10 @@ void irtkReconstruction::RestoreSliceIntensities() {
 
     dp.Get<int>() = RESTORE_SLICE_INTENSITIES;
 
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[RESTORE_SLICE_INTENSITIES].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 }
@@ -1437,9 +2699,6 @@ void irtkReconstruction::ScaleVolume() {
 
   auto start = startTimer();
 
-  _num = 0;
-  _den = 0;
-
   _phase_performance[SCALE_VOLUME].wait += Gather("ScaleVolume");
 
   double scale = _num / _den;
@@ -1450,8 +2709,11 @@ void irtkReconstruction::ScaleVolume() {
     ptr++;
   }
 
-  auto seconds = endTimer(start);
-  _phase_performance[SCALE_VOLUME].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SCALE_VOLUME].time += stop - start;
+  _phase_performance[SCALE_VOLUME].calls++;
+  Trace(TRACE_PHASE, SCALE_VOLUME, 0, start, stop);
 
   if (_debug) {
     PrintImageSums("[ScaleVolume output]");
@@ -1463,33 +2725,48 @@ void irtkReconstruction::SliceToVolumeRegistration() {
 
    auto start = startTimer();
 
-   for (int i = 0; i < (int) _nids.size(); i++) {
+   PrepareGather();
+
+   // The backends still hold the previous grid, send the whole images
+   bool resized = _gridChanged;
+   _gridChanged = false;
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+   for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
-    ebbrt::event_manager->SpawnRemote([this, i, index]() {
+    ebbrt::event_manager->SpawnRemote([this, i, index, resized]() {
 
-    auto buf = MakeUniqueIOBuf(sizeof(int));
+    auto buf = MakeUniqueIOBuf(2 * sizeof(int));
     auto dp = buf->GetMutDataPointer();
 
     dp.Get<int>() = SLICE_TO_VOLUME_REGISTRATION;
+    dp.Get<int>() = resized;
 
-    buf->PrependChain(std::move(serializeSlice(_reconstructed)));
+    if (resized) {
+      buf->PrependChain(std::move(serializeImage(_reconstructed)));
+      buf->PrependChain(std::move(serializeImage(_mask)));
+    } else {
+      buf->PrependChain(std::move(serializeSlice(_reconstructed)));
+    }
 
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[SLICE_TO_VOLUME_REGISTRATION].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 
   _phase_performance[GAUSSIAN_RECONSTRUCTION].wait +=
       Gather("SliceToVolumeRegistration");
 
-  auto seconds = endTimer(start);
-  _phase_performance[GAUSSIAN_RECONSTRUCTION].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].time += stop - start;
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].calls++;
+  Trace(TRACE_PHASE, GAUSSIAN_RECONSTRUCTION, 0, start, stop);
   if (_debug) {
     PrintImageSums("[SliceToVolumeRegistration output]");
   }
@@ -1499,9 +2776,6 @@ void irtkReconstruction::InitializeRobustStatistics() {
 
   auto start = startTimer();
 
-  _sigmaSum = 0;
-  _numSum = 0;
-
   _phase_performance[INITIALIZE_ROBUST_STATISTICS].wait +=
       Gather("Simulate Slices & InitializeRobustStatistics");
 
@@ -1511,8 +2785,11 @@ void irtkReconstruction::InitializeRobustStatistics() {
   _mixSCPU = 0.9;
   _mCPU = 1 / (2.1 * _maxIntensity - 1.9 * _minIntensity);
 
-  auto seconds = endTimer(start);
-  _phase_performance[INITIALIZE_ROBUST_STATISTICS].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[INITIALIZE_ROBUST_STATISTICS].time += stop - start;
+  _phase_performance[INITIALIZE_ROBUST_STATISTICS].calls++;
+  Trace(TRACE_PHASE, INITIALIZE_ROBUST_STATISTICS, 0, start, stop);
 
   if (_debug) {
     PrintImageSums("[InitializeRobustStatistics output]");
@@ -1547,9 +2824,11 @@ void irtkReconstruction::EStepI() {
   _maxs = 0.0;
   _mins = 1.0;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  PrepareGather();
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1569,10 +2848,10 @@ void irtkReconstruction::EStepI() {
 
     buf->PrependChain(std::move(smallSlicesData));
 
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[E_STEP_I].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
   
@@ -1588,8 +2867,11 @@ void irtkReconstruction::EStepI() {
   else
     _meanS2CPU = (_maxs + _meanSCPU) / 2;
 
-  auto seconds = endTimer(start);
-  _phase_performance[E_STEP_I].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_I].time += stop - start;
+  _phase_performance[E_STEP_I].calls++;
+  Trace(TRACE_PHASE, E_STEP_I, 0, start, stop);
 
   if (_debug) {
     cout << "[EStepI output] _sum: " << _sum << endl;
@@ -1620,9 +2902,11 @@ void irtkReconstruction::EStepII() {
   parameters.meanSCPU = _meanSCPU;
   parameters.meanS2CPU = _meanS2CPU;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  PrepareGather();
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1635,10 +2919,10 @@ void irtkReconstruction::EStepII() {
     dp.Get<int>() = E_STEP_II;
     dp.Get<struct eStepParameters>() = parameters; 
 	
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[E_STEP_II].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 
@@ -1663,8 +2947,11 @@ void irtkReconstruction::EStepII() {
       _sigmaS2CPU = _step * _step / _sigmaFactor;
   }
 
-  auto seconds = endTimer(start);
-  _phase_performance[E_STEP_II].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_II].time += stop - start;
+  _phase_performance[E_STEP_II].calls++;
+  Trace(TRACE_PHASE, E_STEP_II, 0, start, stop);
 
   if (_debug) {
     cout << "[EStepII output] _sum: " << _sum << endl;
@@ -1695,9 +2982,11 @@ void irtkReconstruction::EStepIII() {
   parameters.mixSCPU = _mixSCPU;
   parameters.den = _den;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  PrepareGather();
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1710,10 +2999,10 @@ void irtkReconstruction::EStepIII() {
     dp.Get<int>() = E_STEP_III;
     dp.Get<struct eStepParameters>() = parameters; 
 	
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[E_STEP_III].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 
@@ -1724,8 +3013,11 @@ void irtkReconstruction::EStepIII() {
   else
     _mixSCPU = 0.9;
 
-  auto seconds = endTimer(start);
-  _phase_performance[E_STEP_III].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_III].time += stop - start;
+  _phase_performance[E_STEP_III].calls++;
+  Trace(TRACE_PHASE, E_STEP_III, 0, start, stop);
 
   if (_debug) {
     cout << "[EStepIII output] _sum: " << _sum << endl;
@@ -1748,9 +3040,11 @@ void irtkReconstruction::Scale() {
 
   cout << "In Scale()" << endl;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  PrepareGather();
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1761,17 +3055,20 @@ void irtkReconstruction::Scale() {
 
     dp.Get<int>() = SCALE;
 	
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[SCALE].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 
   _phase_performance[SCALE].wait += Gather("Scale");
 
-  auto seconds = endTimer(start);
-  _phase_performance[SCALE].time += seconds;
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SCALE].time += stop - start;
+  _phase_performance[SCALE].calls++;
+  Trace(TRACE_PHASE, SCALE, 0, start, stop);
 
   if (_debug) 
     cout << "[Scale time] " << seconds << endl;
@@ -1973,9 +3270,11 @@ void irtkReconstruction::SuperResolution(int iteration) {
   _confidenceMap = 0;
   irtkRealImage original = _reconstructed;
 
-  for (int i = 0; i < (int) _nids.size(); i++) {
+  PrepareGather();
 
-    auto index = _frontEnd_cpus_map[_nids[i].ToString()];   // get the cpu index
+  for (int i = 0; i < (int) _numBackendNodes; i++) {
+
+    auto index = _backendCpus[i];   // get the cpu index
     auto cpu_i = ebbrt::Cpu::GetByIndex(index);  // get the cpu
     auto ctxt = cpu_i->get_context();  // context
 
@@ -1987,10 +3286,10 @@ void irtkReconstruction::SuperResolution(int iteration) {
     dp.Get<int>() = SUPERRESOLUTION;
     dp.Get<int>() = iteration;
 	
-    cout << "Sending to network: " << _nids[i].ToString();
+    cout << "Sending to network: " << BackendName(i);
     cout << " to core: " << index << " data of size: " << buf->ComputeChainDataLength() << endl;
     _phase_performance[SUPERRESOLUTION].sent += buf->ComputeChainDataLength();
-    SendMessage(_nids[i], std::move(buf));
+    SendToBackend(i, std::move(buf));
     }, ctxt);
   }
 
@@ -2037,8 +3336,24 @@ void irtkReconstruction::SuperResolution(int iteration) {
     BiasCorrectVolume(original);
   }
 
-  auto seconds = endTimer(start);
-  _phase_performance[SUPERRESOLUTION].time += seconds;
+  // Relative RMS change inside the mask, checked against --convergence
+  double diff = 0, norm = 0;
+  irtkRealPixel *pr = _reconstructed.GetPointerToVoxels();
+  irtkRealPixel *po = original.GetPointerToVoxels();
+  irtkRealPixel *pm = _mask.GetPointerToVoxels();
+  for (int i = 0; i < _reconstructed.GetNumberOfVoxels(); i++) {
+    if (pm[i] == 1) {
+      diff += (pr[i] - po[i]) * (pr[i] - po[i]);
+      norm += po[i] * po[i];
+    }
+  }
+  _reconstructionChange = (norm > 0) ? sqrt(diff / norm) : 0;
+
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SUPERRESOLUTION].time += stop - start;
+  _phase_performance[SUPERRESOLUTION].calls++;
+  Trace(TRACE_PHASE, SUPERRESOLUTION, 0, start, stop);
 
   if (_debug) {
     PrintImageSums("[SuperResolution output]");
@@ -2099,18 +3414,66 @@ void irtkReconstruction::SetSmoothingParameters(double lambda) {
  */
 void irtkReconstruction::ReceiveMessage(Messenger::NetworkId nid,
     std::unique_ptr<IOBuf> &&buffer) {
+  ReceiveFromBackend(NodeIndex(nid), std::move(buffer));
+}
+
+void irtkReconstruction::ReceiveFromBackend(int node,
+    std::unique_ptr<IOBuf> &&buffer) {
   size_t cpu = ebbrt::Cpu::GetMine();
 
-  cout << "Receiving message from: " << nid.ToString() << " data of size: " << buffer->ComputeChainDataLength();
+  // Replies of different backends are handled on different cores
+  std::lock_guard<std::mutex> l(_m);
+
+  cout << "Receiving message from: " << BackendName(node) << " data of size: " << buffer->ComputeChainDataLength();
   cout << " on core: " << cpu << endl;
 
-  auto len = buffer->ComputeChainDataLength();
   auto dp = buffer->GetDataPointer();
   auto fn = dp.Get<int>();
 
+  if (!_orderedReplies || fn == PING) {
+    HandleReply(node, *buffer);
+    return;
+  }
+
+  // Hold the replies of the phase and apply them in node order, so that the
+  // reductions do not depend on the order in which they arrived
+  _pendingReplies[node] = std::move(buffer);
+  if (++_pendingReplyCount < _numBackendNodes)
+    return;
+
+  _pendingReplyCount = 0;
+  for (int i = 0; i < _numBackendNodes; i++) {
+    HandleReply(i, *_pendingReplies[i]);
+    _pendingReplies[i].reset();
+  }
+}
+
+void irtkReconstruction::HandleReply(int node, ebbrt::IOBuf& buffer) {
+  auto len = buffer.ComputeChainDataLength();
+  auto dp = buffer.GetDataPointer();
+  auto fn = dp.Get<int>();
+
   if (fn < WORK_PHASES)
     _phase_performance[fn].recv += len; 
 
+  auto now = TimerNow();
+  Trace(TRACE_RECV, fn, len, now, now);
+
+  // Pings are sent by Ping(), outside of SendToBackend(), and have no
+  // request to close
+  if (fn == PING) {
+    cout << "recevied a ping message" << endl;
+    return;
+  }
+
+  auto& message = _nodeMessages[node][MessageType(fn)];
+  message.recv++;
+  message.recvBytes += len;
+  AddLatency(_nodeMessages[node][_requestType[node]],
+      now - _requestTime[node]);
+
+  auto deserializeStart = DeserializeTime();
+
   switch(fn) {
     case GAUSSIAN_RECONSTRUCTION:
       {
@@ -2164,13 +3527,13 @@ void irtkReconstruction::ReceiveMessage(Messenger::NetworkId nid,
       }
     case GATHER_TIMERS:
       {
-        ReturnFromGatherTimers(dp);
+        ReturnFromGatherTimers(dp, node);
         break;
       }
-    case PING:
+    case REBALANCE:
       {
-          cout << "recevied a ping message" << endl;
-          break;
+        ReturnFrom();
+        break;
       }
     default:
       {
@@ -2178,4 +3541,7 @@ void irtkReconstruction::ReceiveMessage(Messenger::NetworkId nid,
         ebbrt::Cpu::Exit(EXIT_FAILURE);
       }
   } 
+
+  message.deserialize += DeserializeTime() - deserializeStart;
+  DeserializeTime() = deserializeStart;
 }
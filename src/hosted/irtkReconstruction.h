@@ -5,6 +5,9 @@
 
 #include "../utils.h"
 #include "../serialize.h"
+#include "localBackend.h"
+#include "metricsServer.h"
+#include "outputWriter.h"
 
 #include <irtkImage.h>
 #include <irtkTransformation.h>
@@ -18,13 +21,15 @@
 #include <ebbrt/StaticIOBuf.h>
 #include <ebbrt/Cpu.h>
 
+#include <atomic>
+
 using namespace ebbrt;
 
 class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>, 
   public irtkObject {
 
   private:
-    std::unordered_map<string, size_t> _frontEnd_cpus_map;   // maps str(ip) to cpu index
+    vector<size_t> _backendCpus;   // cpu index serving each backend node
 
     // Ebb creation parameters 
     std::unordered_map<uint32_t, ebbrt::Promise<void>> _promise_map;
@@ -34,6 +39,17 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     // EbbRT-related parameters
     std::vector<ebbrt::Messenger::NetworkId> _nids;
     ebbrt::Promise<void> _backendsAllocated;
+    // Backends run in-process (src/hosted/localBackend.h) instead of on nodes
+    bool _localBackends;
+    int _localBackendBase;
+    std::atomic<bool> _backendsReady;
+    // Slices were sent to the backends during the initial reconstruction
+    bool _streamSlices;
+    bool _streamed;
+    // Replies of a phase are applied in node order (see ReceiveFromBackend)
+    bool _orderedReplies;
+    int _pendingReplyCount;
+    vector<std::unique_ptr<ebbrt::IOBuf>> _pendingReplies;
 
     // Input parameters
     string _outputName;  
@@ -53,6 +69,8 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     int _numThreads; 
     int _numBackendNodes; 
     int _numFrontendCPUs; 
+    int _psfSubdivisions;
+    int _coarseIterations;
 
     double _sigma; 
     double _resolution; 
@@ -61,16 +79,68 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     double _lambda; 
     double _smoothingLambda; 
     double _lastIterLambda; 
+    double _convergence;
     double _smoothMask; 
     double _lowIntensityCutoff; 
+    double _analyticPSF;
+    double _coarseFactor;
 
     bool _globalBiasCorrection; 
     bool _intensityMatching; 
     bool _debug; 
     bool _disableBiasCorr; 
 
+    // Dynamic load balancing
+    bool _rebalance;
+    double _rebalanceThreshold;
+
+    // Slice range [first, second) assigned to each backend node
+    vector<pair<int, int>> _sliceRanges;
+    // Number of unpadded pixels of each slice, used as its work estimate
+    vector<double> _sliceCost;
+    // Busy time of each backend node at the last rebalance
+    vector<double> _backendBusy;
+
     phases_data _phase_performance;
+    // Slices moved between back-ends by Rebalance
+    struct phase_data _migration;
     std::vector<phases_data> _backend_performance;
+    std::vector<vector<worker_phases_data>> _backendWorkers;
+
+    // Checkpoint written after every outer iteration, and read by Execute()
+    // when resuming
+    string _checkpointName;
+    bool _resume;
+
+    // Output and per-iteration intermediates, written in the background
+    // with --asyncOutput
+    OutputWriter _writer;
+    string _intermediatesFolder;
+
+    // Live metrics
+    bool _metricsEnabled;
+    MetricsServer _metrics;
+    int _outerIteration;
+    int _innerIteration;
+    int _innerIterations;
+    uint64_t _metricsStart;
+    // Messages exchanged with each backend, and the last request sent to it
+    vector<messages_data> _nodeMessages;
+    vector<messages_data> _backendMessages;
+    vector<counters_data> _backendCounters;
+    vector<uint64_t> _requestTime;
+    vector<int> _requestType;
+
+    // Timeline of this node and of every backend node, and the offset of
+    // each backend clock from ours. Only recorded with --trace.
+    bool _traceEnabled;
+    vector<struct trace_event> _trace;
+    std::mutex _traceMutex;
+    uint64_t _traceOrigin;
+    int _gatherPhase;
+    vector<vector<struct trace_event>> _backendTrace;
+    vector<int64_t> _backendClockOffset;
+    vector<uint64_t> _traceRequestTime;
 
     // Internal parameters
     ebbrt::Promise<void> _reconstructionDone;
@@ -82,6 +152,11 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     irtkRealImage _mask;
     irtkRealImage _volumeWeights;
 
+    // Coarse-to-fine schedule (see SetGrid)
+    bool _coarse;
+    bool _gridChanged;
+    irtkRealImage _fineMask;
+
     vector<double> _scaleCPU;
     vector<double> _sliceWeightCPU;
     vector<double> _slicePotential;
@@ -116,6 +191,10 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     int _numSum;
 
     double _qualityFactor;
+    // Relative change of the volume inside the mask in the last
+    // SuperResolution()
+    double _reconstructionChange;
+    double _psfRadius;
     double _step; 
     double _sigmaSCPU;
     double _sigmaS2CPU;
@@ -165,6 +244,10 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     double _mMin;
     double _mMax;
 
+    friend class ParallelCreateSlices;
+    friend class ParallelMaskSlices;
+    friend class ParallelInitializeEM;
+
   public:
 
     // Constructor
@@ -183,9 +266,27 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     void ReceiveMessage(ebbrt::Messenger::NetworkId nid,
         std::unique_ptr<ebbrt::IOBuf>&& buffer);
 
+    void ReceiveFromBackend(int node, std::unique_ptr<ebbrt::IOBuf>&& buffer);
+
+    void HandleReply(int node, ebbrt::IOBuf& buffer);
+
+    // answered is false for messages the backend does not reply to
+    void SendToBackend(int node, std::unique_ptr<ebbrt::IOBuf>&& buf,
+        bool answered = true);
+
+    void SizeNodeCounters();
+
+    string BackendName(int node);
+
     // Node allocation functions
+    size_t ReserveBackendCpu();
+
     void AddNid(ebbrt::Messenger::NetworkId nid);
 
+    void AddLocalBackends(int numNodes, struct localBackendLink link);
+
+    void ReleaseBackends();
+
     ebbrt::Future<void> WaitPool();
 
     ebbrt::Future<void> ReconstructionDone();
@@ -195,6 +296,8 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
 
     void SetDefaultParameters();
 
+    void Reset();
+
     void SetSmoothingParameters(double lambda);
 
     irtkRealImage CreateMask(irtkRealImage image);
@@ -208,6 +311,10 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     void CropImage(irtkRealImage& image,
         irtkRealImage& mask);
 
+    void MaskStacks(vector<irtkRealImage>& stacks,
+        vector<irtkRigidTransformation>& stackTransformations,
+        int templateNumber);
+
     void InvertStackTransformations(
         vector<irtkRigidTransformation>& stack_transformations);
 
@@ -216,6 +323,8 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
 
     irtkRealImage GetMask();
 
+    irtkRealImage GetReconstructed();
+
     void SetMask(irtkRealImage * mask, double sigma, double threshold = 0.5);
 
     void StackRegistrations(vector<irtkRealImage>& stacks,
@@ -240,6 +349,8 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
 
     void MaskSlices();
 
+    void MaskSlices(int first, int last);
+
     void ReadTransformation(char* folder);
 
     void InitializeEM();
@@ -249,16 +360,24 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
     struct reconstructionParameters CreateReconstructionParameters(
         int start, int end);
 
-    float Gather(string fn);
+    void PrepareGather();
+
+    uint64_t Gather(string fn);
 
     void ReturnFrom();
 
     // CoeffInit() function
     struct coeffInitParameters createCoeffInitParameters();
 
-    void CoeffInitBootstrap(struct coeffInitParameters parameters);
+    void CoeffInitBootstrap(struct coeffInitParameters parameters,
+        int mode = COEFF_INIT_BOOTSTRAP);
+
+    void CoeffInit(struct coeffInitParameters parameters,
+        int mode = COEFF_INIT_PARAMETERS);
 
-    void CoeffInit(struct coeffInitParameters parameters);
+    bool StartStreaming();
+
+    void StreamSlices(int first, int last);
 
     void CoeffInit(int iteration);
 
@@ -340,15 +459,61 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
 
     void ReturnFromSliceToVolumeRegistration(ebbrt::IOBuf::DataPointer & dp);
 
+    // Dynamic load balancing functions
+    int NodeIndex(ebbrt::Messenger::NetworkId nid);
+
+    void InitializeSliceRanges();
+
+    vector<pair<int, int>> ComputeSliceRanges(vector<double>& speed);
+
+    void MigrateSlices(vector<pair<int, int>>& ranges);
+
+    double BackendBusy(int node);
+
+    void StartRebalanceWindow();
+
+    void Rebalance();
+
+    // Checkpoint functions
+    void WriteCheckpoint(int iteration);
+
+    int ReadCheckpoint();
+
+    void ResumeBackends();
+
+    void SetGrid(bool coarse);
+
     // Start program execution
-    void ReturnFromGatherTimers(ebbrt::IOBuf::DataPointer & dp);
+    void ReturnFromGatherTimers(ebbrt::IOBuf::DataPointer & dp, int node);
+
+    void RequestBackendTimers();
 
     void GatherBackendTimers();
 
     void GatherFrontendTimers();
 
+    void WriteTimers(string filename);
+
+    void Trace(uint32_t type, int phase, uint32_t bytes, uint64_t begin,
+        uint64_t end);
+
+    void WriteTraceEvent(ostream& out, struct trace_event& event, int pid,
+        int64_t offset);
+
+    void WriteTrace(string filename);
+
+    void StartMetrics(string path);
+
+    void PublishMetrics();
+
+    void StopMetrics();
+
     void Execute();
 
+    void WriteIntermediates(int iteration);
+
+    void WaitForOutput();
+
     // Static Reconstruction functions
     static void ResetOrigin(irtkGreyImage &image, 
         irtkRigidTransformation& transformation);
@@ -364,11 +529,12 @@ class irtkReconstruction : public ebbrt::Messagable<irtkReconstruction>,
 };
 
 inline double irtkReconstruction::SumImage(irtkRealImage img) {
-  float sum = 0.0;
+  // Accumulate in double so that the checksum is not dominated by rounding
+  double sum = 0.0;
   irtkRealPixel *ap = img.GetPointerToVoxels();
 
   for (int j = 0; j < img.GetNumberOfVoxels(); j++) {
-      sum += (float)*ap;
+      sum += *ap;
     ap++;
   }
   return (double)sum;
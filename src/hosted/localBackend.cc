@@ -0,0 +1,144 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "localBackend.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <ebbrt/Cpu.h>
+#include <ebbrt/EventManager.h>
+#include <ebbrt/UniqueIOBuf.h>
+
+#include "../irtkBackend.h"
+
+typedef std::function<void(std::unique_ptr<ebbrt::IOBuf>&&)> LocalDelivery;
+
+// A message on the link of a local backend and the time it arrives at
+struct localMessage {
+  uint64_t arrival;
+  std::unique_ptr<ebbrt::IOBuf> buffer;
+  LocalDelivery deliver;
+};
+
+// Messages in flight on the link of one backend, in both directions
+struct localLinkQueue {
+  std::mutex m;
+  std::deque<localMessage> messages;
+  uint64_t lastArrival{0};
+  bool polling{false};
+};
+
+static std::vector<irtkBackend*> localBackends;
+static std::vector<std::unique_ptr<localLinkQueue>> localQueues;
+static struct localBackendLink localLink;
+static bool localCounters = false;
+
+// Delivers the messages of the link that arrived, and yields the core to the
+// other events until the next one does
+static void PollLink(localLinkQueue *queue) {
+  while (true) {
+    localMessage message;
+    {
+      std::lock_guard<std::mutex> l(queue->m);
+      if (queue->messages.empty()) {
+        queue->polling = false;
+        return;
+      }
+      if (queue->messages.front().arrival > TimerNow())
+        break;
+      message = std::move(queue->messages.front());
+      queue->messages.pop_front();
+    }
+    message.deliver(std::move(message.buffer));
+  }
+
+  ebbrt::event_manager->Spawn([queue]() { PollLink(queue); }, true);
+}
+
+/*
+ * Moves a message over the loopback link of a local backend: it is copied
+ * into a contiguous buffer, as on the wire, and handed to deliver after
+ * latency + size / bandwidth seconds, from an event of the calling core.
+ * Messages of a link arrive in the order they were sent.
+ */
+static void LocalTransfer(int node, std::unique_ptr<ebbrt::IOBuf>&& buffer,
+    LocalDelivery deliver) {
+  auto len = buffer->ComputeChainDataLength();
+  auto copy = MakeUniqueIOBuf(len);
+  auto dp = buffer->GetDataPointer();
+  dp.Get(len, copy->MutData());
+
+  double delay = localLink.latency;
+  if (localLink.bandwidth > 0)
+    delay += len / localLink.bandwidth;
+  if (delay <= 0) {
+    deliver(std::move(copy));
+    return;
+  }
+
+  auto queue = localQueues[node].get();
+  auto arrival = TimerNow() + (uint64_t) (delay * 1e9);
+  bool poll;
+  {
+    std::lock_guard<std::mutex> l(queue->m);
+    arrival = std::max(arrival, queue->lastArrival);
+    queue->lastArrival = arrival;
+    queue->messages.push_back({arrival, std::move(copy), std::move(deliver)});
+    poll = !queue->polling;
+    queue->polling = true;
+  }
+
+  if (poll)
+    ebbrt::event_manager->Spawn([queue]() { PollLink(queue); }, true);
+}
+
+int CreateLocalBackends(int numNodes, struct localBackendLink link,
+    LocalReplyHandler handler) {
+  int first = localBackends.size();
+  localLink = link;
+  for (int i = 0; i < numNodes; i++) {
+    int node = first + i;
+    auto backend = new irtkBackend(
+        [node, i, handler](ebbrt::Messenger::NetworkId nid,
+          std::unique_ptr<ebbrt::IOBuf>&& buf) {
+          LocalTransfer(node, std::move(buf),
+              [i, handler](std::unique_ptr<ebbrt::IOBuf>&& reply) {
+                handler(i, std::move(reply));
+              });
+        });
+    if (localCounters)
+      backend->EnablePerfCounters();
+    localBackends.push_back(backend);
+    localQueues.emplace_back(new localLinkQueue());
+  }
+  return first;
+}
+
+void SendToLocalBackend(int node, std::unique_ptr<ebbrt::IOBuf>&& buffer) {
+  auto cpu = ebbrt::Cpu::GetMine();
+  LocalTransfer(node, std::move(buffer),
+      [node, cpu](std::unique_ptr<ebbrt::IOBuf>&& message) {
+        localBackends[node]->HandleMessage(ebbrt::Messenger::NetworkId(),
+            *message, cpu);
+      });
+}
+
+void EnableLocalBackendCounters() {
+  localCounters = true;
+}
+
+phases_data LocalBackendPhases(int node) {
+  return localBackends[node]->GetPhasePerformance();
+}
+
+uint64_t LocalBackendCoefficients() {
+  uint64_t coefficients = 0;
+  for (auto backend : localBackends)
+    coefficients += backend->CountCoefficients();
+  return coefficients;
+}
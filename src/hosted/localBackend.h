@@ -0,0 +1,47 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef LOCAL_BACKEND_H
+#define LOCAL_BACKEND_H
+
+#include <functional>
+#include <memory>
+
+#include <ebbrt/IOBuf.h>
+
+#include "../utils.h"
+
+// Back-end kernels (src/irtkBackend.h) running inside the hosted process.
+// Messages use the same encoding as the network path; replies are handed to
+// the handler on the caller's core together with the index of the backend.
+typedef std::function<void(int, std::unique_ptr<ebbrt::IOBuf>&&)>
+  LocalReplyHandler;
+
+// Loopback link between the front-end and each local backend. Every message
+// is copied into a contiguous buffer, as on the wire, and delivered after
+// latency + size / bandwidth seconds. The core is not blocked meanwhile.
+struct localBackendLink {
+  double latency;    // seconds
+  double bandwidth;  // bytes per second, 0 for unlimited
+};
+
+// Returns the index of the first of the numNodes backends created, the
+// handler is given indices relative to it
+int CreateLocalBackends(int numNodes, struct localBackendLink link,
+    LocalReplyHandler handler);
+
+// The request is handled on the calling core once it arrived, using the
+// backend's worker threads for the kernels. node is an absolute index.
+void SendToLocalBackend(int node, std::unique_ptr<ebbrt::IOBuf>&& buffer);
+
+// Samples hardware counters around every kernel of the local backends
+void EnableLocalBackendCounters();
+
+// Phase timers of a local backend, for benchmarks
+phases_data LocalBackendPhases(int node);
+
+// Number of PSF coefficients held by all local backends
+uint64_t LocalBackendCoefficients();
+
+#endif
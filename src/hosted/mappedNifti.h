@@ -0,0 +1,150 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef MAPPED_NIFTI_H
+#define MAPPED_NIFTI_H
+
+#include <irtkImage.h>
+#include <nifti1_io.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <cstring>
+
+// Converts the mapped voxels of a NIfTI file to the doubles of image, one
+// chunk of slices per TBB task. Only the pages a task touches are read.
+template <typename T>
+inline void ConvertMappedVoxels(const char *data, irtkRealImage &image,
+    double slope, double intercept, int numThreads) {
+  const T *voxels = reinterpret_cast<const T *>(data);
+  irtkRealPixel *ptr = image.GetPointerToVoxels();
+  size_t slice = (size_t)image.GetX() * image.GetY();
+
+  task_scheduler_init init(numThreads);
+  parallel_for(blocked_range<size_t>(0, image.GetZ()),
+      [=](const blocked_range<size_t> &r) {
+        for (size_t i = r.begin() * slice; i < r.end() * slice; i++)
+          ptr[i] = voxels[i] * slope + intercept;
+      });
+  init.terminate();
+}
+
+// Reads an uncompressed single-file NIfTI (.nii) image through mmap instead of
+// irtkRealImage::Read. Returns false, leaving image untouched, for the files
+// it does not handle (compressed, .hdr/.img, 4D, foreign byte order, unusual
+// voxel types) so that the caller can fall back to IRTK.
+inline bool ReadMappedNifti(const string &name, irtkRealImage &image,
+    int numThreads) {
+  nifti_image *nim = nifti_image_read(name.c_str(), 0);
+  if (nim == NULL)
+    return false;
+
+  bool supported = (nim->nifti_type == NIFTI_FTYPE_NIFTI1_1) &&
+    !nifti_is_gzfile(nim->fname) && (nim->nt <= 1) &&
+    (nim->byteorder == nifti_short_order());
+  switch (nim->datatype) {
+    case DT_UINT8: case DT_INT8: case DT_INT16: case DT_UINT16:
+    case DT_INT32: case DT_FLOAT32: case DT_FLOAT64:
+      break;
+    default:
+      supported = false;
+  }
+  if (!supported) {
+    nifti_image_free(nim);
+    return false;
+  }
+
+  int fd = open(name.c_str(), O_RDONLY);
+  struct stat st;
+  size_t bytes = (size_t)nim->nx * nim->ny * nim->nz * nim->nbyper;
+  if ((fd < 0) || (fstat(fd, &st) != 0) ||
+      ((size_t)st.st_size < nim->iname_offset + bytes)) {
+    if (fd >= 0)
+      close(fd);
+    nifti_image_free(nim);
+    return false;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    nifti_image_free(nim);
+    return false;
+  }
+
+  // Voxel to world matrix as chosen by IRTK, qform first
+  mat44 mat = (nim->qform_code > 0) ? nim->qto_xyz : nim->sto_xyz;
+  if ((nim->qform_code <= 0) && (nim->sform_code <= 0)) {
+    memset(&mat, 0, sizeof(mat));
+    mat.m[0][0] = nim->dx;
+    mat.m[1][1] = nim->dy;
+    mat.m[2][2] = nim->dz;
+    mat.m[3][3] = 1;
+  }
+
+  irtkImageAttributes attr;
+  attr._x = nim->nx;
+  attr._y = nim->ny;
+  attr._z = nim->nz;
+  attr._t = 1;
+  attr._dx = fabs(nim->dx);
+  attr._dy = fabs(nim->dy);
+  attr._dz = fabs(nim->dz);
+  for (int i = 0; i < 3; i++) {
+    attr._xaxis[i] = mat.m[i][0] / attr._dx;
+    attr._yaxis[i] = mat.m[i][1] / attr._dy;
+    attr._zaxis[i] = mat.m[i][2] / attr._dz;
+  }
+  // IRTK places the origin at the centre of the image
+  double cx = (attr._x - 1) / 2.0;
+  double cy = (attr._y - 1) / 2.0;
+  double cz = (attr._z - 1) / 2.0;
+  attr._xorigin = mat.m[0][0] * cx + mat.m[0][1] * cy + mat.m[0][2] * cz +
+    mat.m[0][3];
+  attr._yorigin = mat.m[1][0] * cx + mat.m[1][1] * cy + mat.m[1][2] * cz +
+    mat.m[1][3];
+  attr._zorigin = mat.m[2][0] * cx + mat.m[2][1] * cy + mat.m[2][2] * cz +
+    mat.m[2][3];
+
+  double slope = (nim->scl_slope != 0) ? nim->scl_slope : 1;
+  double intercept = (nim->scl_slope != 0) ? nim->scl_inter : 0;
+
+  image.Initialize(attr);
+  madvise(map, st.st_size, MADV_WILLNEED);
+  const char *data = static_cast<const char *>(map) + nim->iname_offset;
+
+  switch (nim->datatype) {
+    case DT_UINT8:
+      ConvertMappedVoxels<uint8_t>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_INT8:
+      ConvertMappedVoxels<int8_t>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_INT16:
+      ConvertMappedVoxels<int16_t>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_UINT16:
+      ConvertMappedVoxels<uint16_t>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_INT32:
+      ConvertMappedVoxels<int32_t>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_FLOAT32:
+      ConvertMappedVoxels<float>(data, image, slope, intercept, numThreads);
+      break;
+    case DT_FLOAT64:
+      ConvertMappedVoxels<double>(data, image, slope, intercept, numThreads);
+      break;
+  }
+
+  munmap(map, st.st_size);
+  nifti_image_free(nim);
+  return true;
+}
+
+#endif
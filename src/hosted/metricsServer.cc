@@ -0,0 +1,109 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "metricsServer.h"
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+// Seconds a client may take to send its request or read the response
+#define CLIENT_TIMEOUT 2
+
+void MetricsServer::Start(string path) {
+  struct sockaddr_un addr;
+
+  if (path.size() >= sizeof(addr.sun_path)) {
+    cerr << "ERROR: metrics socket path too long: " << path << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  // Remove the socket left behind by a previous run
+  unlink(path.c_str());
+
+  _fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (_fd < 0 || bind(_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(_fd, 4) < 0) {
+    cerr << "ERROR: cannot listen on " << path << ": " << strerror(errno)
+      << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  _path = path;
+  std::thread([this]() { Serve(); }).detach();
+
+  cout << "Serving metrics on " << path << endl;
+}
+
+void MetricsServer::Stop() {
+  if (_fd < 0 || _stopped.exchange(true))
+    return;
+
+  // Wakes up the accept() of Serve()
+  shutdown(_fd, SHUT_RDWR);
+  unlink(_path.c_str());
+}
+
+void MetricsServer::Publish(string text) {
+  std::lock_guard<std::mutex> l(_m);
+  _snapshot = std::move(text);
+}
+
+void MetricsServer::Serve() {
+  char request[4096];
+
+  while (true) {
+    int client = accept(_fd, NULL, NULL);
+    if (client < 0) {
+      if (_stopped)
+        break;
+      continue;
+    }
+
+    // A client that stops sending or reading must not hold up the others
+    struct timeval timeout = {CLIENT_TIMEOUT, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // The request itself is irrelevant, every path gets the same metrics
+    recv(client, request, sizeof(request), 0);
+
+    string body;
+    {
+      std::lock_guard<std::mutex> l(_m);
+      body = _snapshot;
+    }
+
+    string response = "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    size_t written = 0;
+    while (written < response.size()) {
+      // A client that disconnects early must not raise SIGPIPE
+      auto n = send(client, response.data() + written,
+          response.size() - written, MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      written += n;
+    }
+    close(client);
+  }
+
+  close(_fd);
+}
@@ -0,0 +1,36 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+// Serves the last published metrics, in the Prometheus text format, to any
+// HTTP request on a Unix socket, e.g.
+//   curl --unix-socket <path> http://localhost/metrics
+// Requests are answered by a plain thread outside of EbbRT, so that a
+// reconstruction blocked in a phase can still be observed.
+class MetricsServer {
+  public:
+    void Start(std::string path);
+
+    // Stops answering and removes the socket
+    void Stop();
+
+    void Publish(std::string text);
+
+  private:
+    void Serve();
+
+    std::mutex _m;
+    std::string _snapshot;
+    std::string _path;
+    int _fd{-1};
+    std::atomic<bool> _stopped{false};
+};
+
+#endif
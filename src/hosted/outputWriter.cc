@@ -0,0 +1,222 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "outputWriter.h"
+
+#include <nifti1_io.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Uncompressed bytes per gzip member
+#define GZIP_CHUNK (4 << 20)
+
+// sizeof(nifti_1_header) and the 4 bytes of the extension flag
+#define NIFTI_VOX_OFFSET 352
+
+void OutputWriter::Start(int numThreads) {
+  _numThreads = numThreads;
+  if (_started)
+    return;
+  _started = true;
+  std::thread([this]() { Run(); }).detach();
+}
+
+void OutputWriter::Write(const irtkRealImage& image, string name) {
+  auto copy = std::make_shared<irtkRealImage>(image);
+  auto numThreads = _numThreads;
+  Submit([copy, name, numThreads]() {
+    return WriteImage(*copy, name, numThreads);
+  });
+}
+
+void OutputWriter::Submit(std::function<bool()> job) {
+  if (!_started) {
+    if (!job())
+      _failed = true;
+    return;
+  }
+
+  std::lock_guard<std::mutex> l(_m);
+  _jobs.push_back(std::move(job));
+  _cv.notify_all();
+}
+
+bool OutputWriter::Wait() {
+  std::unique_lock<std::mutex> l(_m);
+  _cv.wait(l, [this]() { return _jobs.empty() && !_busy; });
+  return !_failed;
+}
+
+void OutputWriter::Run() {
+  while (true) {
+    std::function<bool()> job;
+    {
+      std::unique_lock<std::mutex> l(_m);
+      _cv.wait(l, [this]() { return !_jobs.empty(); });
+      job = std::move(_jobs.front());
+      _jobs.pop_front();
+      _busy = true;
+    }
+
+    auto written = job();
+
+    std::lock_guard<std::mutex> l(_m);
+    if (!written)
+      _failed = true;
+    _busy = false;
+    _cv.notify_all();
+  }
+}
+
+static bool EndsWith(const string& name, const string& suffix) {
+  return name.size() > suffix.size() &&
+    name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * The single file NIfTI-1 header IRTK writes for the image: the
+ * image-to-world matrix is both the qform and the sform. The voxels follow
+ * the 4 bytes of the empty extension.
+ */
+static nifti_1_header NiftiHeader(irtkRealImage& image) {
+  irtkImageAttributes attr = image.GetImageAttributes();
+  irtkMatrix i2w = image.GetImageToWorldMatrix();
+
+  nifti_image *nim = nifti_simple_init_nim();
+  nim->nifti_type = NIFTI_FTYPE_NIFTI1_1;
+  nim->ndim = nim->dim[0] = (attr._t > 1) ? 4 : 3;
+  nim->nx = nim->dim[1] = attr._x;
+  nim->ny = nim->dim[2] = attr._y;
+  nim->nz = nim->dim[3] = attr._z;
+  nim->nt = nim->dim[4] = attr._t;
+  nim->nu = nim->dim[5] = 1;
+  nim->nv = nim->dim[6] = 1;
+  nim->nw = nim->dim[7] = 1;
+  nim->nvox = image.GetNumberOfVoxels();
+  nim->dx = nim->pixdim[1] = attr._dx;
+  nim->dy = nim->pixdim[2] = attr._dy;
+  nim->dz = nim->pixdim[3] = attr._dz;
+  nim->dt = nim->pixdim[4] = attr._dt;
+  nim->datatype = (sizeof(irtkRealPixel) == 4) ? DT_FLOAT32 : DT_FLOAT64;
+  nim->nbyper = sizeof(irtkRealPixel);
+  nim->scl_slope = 1;
+  nim->scl_inter = 0;
+  nim->xyz_units = NIFTI_UNITS_MM;
+  nim->time_units = NIFTI_UNITS_SEC;
+  nim->toffset = attr._torigin;
+  nim->iname_offset = NIFTI_VOX_OFFSET;
+
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      nim->qto_xyz.m[i][j] = nim->sto_xyz.m[i][j] = i2w(i, j);
+  nim->qform_code = NIFTI_XFORM_SCANNER_ANAT;
+  nim->sform_code = NIFTI_XFORM_SCANNER_ANAT;
+  nifti_mat44_to_quatern(nim->qto_xyz, &nim->quatern_b, &nim->quatern_c,
+      &nim->quatern_d, &nim->qoffset_x, &nim->qoffset_y, &nim->qoffset_z,
+      NULL, NULL, NULL, &nim->qfac);
+
+  auto header = nifti_convert_nim2nhdr(nim);
+  nifti_image_free(nim);
+  return header;
+}
+
+// Deflates data into one gzip member
+static bool Deflate(const char *data, size_t length,
+    vector<unsigned char>& member) {
+  z_stream zs = {};
+  // 16 + MAX_WBITS writes a gzip header and trailer
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+        16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  member.resize(deflateBound(&zs, length));
+  zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  zs.avail_in = length;
+  zs.next_out = member.data();
+  zs.avail_out = member.size();
+  bool done = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+  member.resize(zs.total_out);
+  deflateEnd(&zs);
+  return done;
+}
+
+/*
+ * NIfTI images are written from memory: the header is built here and
+ * followed by the voxels of the image. IRTK compresses .nii.gz files on a
+ * single thread, here the header and each GZIP_CHUNK of the voxels are
+ * deflated by TBB tasks into their own gzip members; zlib and niftilib read
+ * concatenated members as one file. Other formats are written by IRTK.
+ */
+bool OutputWriter::WriteImage(irtkRealImage& image, string name,
+    int numThreads) {
+  bool gzip = EndsWith(name, ".nii.gz");
+  if (!gzip && !EndsWith(name, ".nii")) {
+    image.Write(name.c_str());
+    if (!ifstream(name)) {
+      cerr << "ERROR: cannot write " << name << endl;
+      return false;
+    }
+    return true;
+  }
+
+  // The header and the empty extension
+  vector<char> header(NIFTI_VOX_OFFSET, 0);
+  auto hdr = NiftiHeader(image);
+  memcpy(header.data(), &hdr, sizeof(hdr));
+
+  auto voxels = reinterpret_cast<const char *>(image.GetPointerToVoxels());
+  size_t size = image.GetNumberOfVoxels() * sizeof(irtkRealPixel);
+
+  ofstream out(name, ios::binary);
+  if (!gzip) {
+    out.write(header.data(), header.size());
+    out.write(voxels, size);
+  } else {
+    // Member 0 is the header
+    size_t chunks = (size + GZIP_CHUNK - 1) / GZIP_CHUNK;
+    vector<vector<unsigned char>> members(chunks + 1);
+    std::atomic<bool> failed(false);
+
+    task_scheduler_init init(max(numThreads, 1));
+    parallel_for(blocked_range<size_t>(0, chunks + 1),
+        [&](const blocked_range<size_t>& r) {
+          for (size_t c = r.begin(); c != r.end(); ++c) {
+            bool deflated;
+            if (c == 0) {
+              deflated = Deflate(header.data(), header.size(), members[c]);
+            } else {
+              size_t offset = (c - 1) * GZIP_CHUNK;
+              size_t length = min((size_t) GZIP_CHUNK, size - offset);
+              deflated = Deflate(voxels + offset, length, members[c]);
+            }
+            if (!deflated)
+              failed = true;
+          }
+        });
+    init.terminate();
+
+    if (failed) {
+      cerr << "ERROR: cannot compress " << name << endl;
+      return false;
+    }
+
+    for (auto& member : members)
+      out.write(reinterpret_cast<const char *>(member.data()), member.size());
+  }
+
+  out.close();
+  if (!out) {
+    cerr << "ERROR: cannot write " << name << endl;
+    return false;
+  }
+  return true;
+}
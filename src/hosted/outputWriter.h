@@ -0,0 +1,50 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <irtkImage.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Writes output files in the order they are submitted. Once started, the
+// files are written by a plain thread outside of EbbRT so that the
+// reconstruction does not wait for the disk; otherwise they are written by
+// the caller. .gz images are compressed in parallel chunks. Failures are
+// reported by Wait(), on the caller's thread.
+class OutputWriter {
+  public:
+    void Start(int numThreads);
+
+    // The image is copied, the caller may keep updating it
+    void Write(const irtkRealImage& image, std::string name);
+
+    // A job returns false if it failed
+    void Submit(std::function<bool()> job);
+
+    // Returns once every submitted file is written, false if any failed
+    bool Wait();
+
+    static bool WriteImage(irtkRealImage& image, std::string name,
+        int numThreads);
+
+  private:
+    void Run();
+
+    std::mutex _m;
+    std::condition_variable _cv;
+    std::deque<std::function<bool()>> _jobs;
+    bool _started{false};
+    bool _busy{false};
+    bool _failed{false};
+    int _numThreads{1};
+};
+
+#endif
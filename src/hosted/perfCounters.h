@@ -0,0 +1,81 @@
+//    Copyright Boston University SESA Group 2013 - 2014.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "../utils.h"
+
+// Hardware counters of the calling thread between Start() and Stop(), read
+// through perf_event. Events the kernel refuses (perf_event_paranoid, no PMU
+// in the VM) are left at 0; a disabled instance does nothing.
+class PerfCounters {
+  public:
+    PerfCounters(bool enabled) {
+      static const uint64_t events[] = {PERF_COUNT_HW_CPU_CYCLES,
+                                        PERF_COUNT_HW_INSTRUCTIONS,
+                                        PERF_COUNT_HW_CACHE_MISSES,
+                                        PERF_COUNT_HW_BRANCH_MISSES};
+
+      for (int i = 0; i < EVENTS; i++) {
+        _fds[i] = -1;
+        if (!enabled)
+          continue;
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = events[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      }
+    }
+
+    ~PerfCounters() {
+      for (auto fd : _fds)
+        if (fd >= 0)
+          close(fd);
+    }
+
+    void Start() {
+      for (auto fd : _fds) {
+        if (fd >= 0) {
+          ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+          ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+      }
+    }
+
+    void Stop(struct counter_data& data) {
+      uint64_t values[EVENTS] = {};
+      for (int i = 0; i < EVENTS; i++) {
+        if (_fds[i] >= 0) {
+          ioctl(_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+          if (read(_fds[i], &values[i], sizeof(values[i])) !=
+              sizeof(values[i]))
+            values[i] = 0;
+        }
+      }
+      data.cycles += values[0];
+      data.instructions += values[1];
+      data.cacheMisses += values[2];
+      data.branchMisses += values[3];
+    }
+
+  private:
+    static const int EVENTS = 4;
+    int _fds[EVENTS];
+};
+
+#endif
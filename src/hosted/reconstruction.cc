@@ -14,7 +14,7 @@ void parseInputParameters(int argc, char **argv) {
     po::options_description desc("Options");
     desc.add_options()("help,h", "Print usage messages")
       ("output,o", 
-        po::value<string>(&ARGUMENTS.outputName)->required(),
+        po::value<string>(&ARGUMENTS.outputName),
         "Name for the reconstructed volume. Nifti or Analyze format.")
       ("mask,m", 
         po::value<string>(&ARGUMENTS.maskName), 
@@ -45,6 +45,16 @@ void parseInputParameters(int argc, char **argv) {
       ("multires", 
         po::value<int>(&ARGUMENTS.levels)->default_value(3),
         "Multiresolution smooting with given number of levels. [Default: 3]")
+      ("coarseIterations",
+        po::value<int>(&ARGUMENTS.coarseIterations)->default_value(0),
+        "Reconstruct the first outer iterations on a grid --coarseFactor "
+        "times coarser than --resolution and upsample the volume for the "
+        "remaining ones. The last iteration always uses --resolution. "
+        "[Default: 0]")
+      ("coarseFactor",
+        po::value<double>(&ARGUMENTS.coarseFactor)->default_value(2),
+        "Voxel size of the --coarseIterations grid relative to --resolution. "
+        "[Default: 2]")
       ("average", 
         po::value<double>(&ARGUMENTS.averageValue)->default_value(700),
         "Average intensity value for stacks [Default: 700]")
@@ -84,6 +94,11 @@ void parseInputParameters(int argc, char **argv) {
       ("recIterationsLast",
         po::value<int>(&ARGUMENTS.recIterationsLast)->default_value(13),
         "Set number of superresolution iterations for the last iteration")
+      ("convergence",
+        po::value<double>(&ARGUMENTS.convergence)->default_value(0),
+        "End the superresolution iterations of an outer iteration early once "
+        "the relative RMS change of the volume inside the mask falls below "
+        "this value, 0 to always run all of them. [Default: 0]")
       ("numStacksTuner",
         po::value<unsigned int>(&ARGUMENTS.numInputStacksTuner)->default_value(0),
         "Set number of input stacks that are really used (for tuner "
@@ -95,6 +110,30 @@ void parseInputParameters(int argc, char **argv) {
         po::value<string>(&ARGUMENTS.sFolder),
         "[folder] Use existing registered slices and replace loaded ones "
         "(have to be equally many as loaded from stacks).")
+      ("timings",
+        po::value<string>(&ARGUMENTS.timingsFile),
+        "[file] Write the per-phase timers of every node to this CSV file.")
+      ("trace",
+        po::value<string>(&ARGUMENTS.traceFile),
+        "[file] Write a Chrome trace (chrome://tracing, Perfetto) of the "
+        "phases, workers and messages of every node to this file.")
+      ("metricsSocket",
+        po::value<string>(&ARGUMENTS.metricsSocket),
+        "[path] Serve live progress metrics over HTTP on this Unix socket, "
+        "e.g. curl --unix-socket <path> http://localhost/metrics")
+      ("checkpoint",
+        po::value<string>(&ARGUMENTS.checkpointFile),
+        "[file] Save the reconstruction state to this file after every outer "
+        "iteration.")
+      ("resume",
+        po::bool_switch(&ARGUMENTS.resume)->default_value(false),
+        "Restart from the state saved in the --checkpoint file instead of "
+        "from the first iteration.")
+      ("batch",
+        po::value<string>(&ARGUMENTS.batchFile),
+        "[file] Reconstruct every subject of this manifest with the same "
+        "back-end nodes. Each line holds the options of one subject (-o, -i, "
+        "-t, --thickness, -m, ...) added to the ones of the command line.")
       ("T1PackageSize", 
         po::value<unsigned int>(&ARGUMENTS.T1PackageSize)->default_value(0),
         "is a test if you can register T1 to T2 using NMI and only one "
@@ -104,6 +143,65 @@ void parseInputParameters(int argc, char **argv) {
         "disable bias field correction for cases with little or no bias field "
         "inhomogenities (makes it faster but less reliable for stron intensity "
         "bias)")
+      ("rebalance",
+        po::bool_switch(&ARGUMENTS.rebalance)->default_value(false),
+        "Migrate slices from slow to fast back-end nodes after each outer "
+        "iteration, according to the time they spent in the previous one")
+      ("rebalanceThreshold",
+        po::value<double>(&ARGUMENTS.rebalanceThreshold)->default_value(0.1),
+        "Minimum imbalance (slowest node time / average node time - 1) that "
+        "triggers a slice migration. [Default: 0.1]")
+      ("localBackends",
+        po::bool_switch(&ARGUMENTS.localBackends)->default_value(false),
+        "Run the back-end kernels in this process, on numThreads threads per "
+        "back-end, instead of allocating back-end EbbRT nodes")
+      ("localLatency",
+        po::value<double>(&ARGUMENTS.localLatency)->default_value(0),
+        "Latency in microseconds added to every message exchanged with "
+        "local back-ends. [Default: 0]")
+      ("localBandwidth",
+        po::value<double>(&ARGUMENTS.localBandwidth)->default_value(0),
+        "Bandwidth in MB/s of the link to each local back-end, 0 for "
+        "unlimited. [Default: 0]")
+      ("orderedReplies",
+        po::bool_switch(&ARGUMENTS.orderedReplies)->default_value(false),
+        "Apply the back-end replies of each phase in node order, so that "
+        "results do not depend on message arrival order")
+      ("streamSlices",
+        po::bool_switch(&ARGUMENTS.streamSlices)->default_value(false),
+        "Send the slices to the back-ends stack by stack as soon as the "
+        "initial reconstruction creates them, if the back-ends are already "
+        "allocated, so that they compute the PSF coefficients early. Not "
+        "used with --batch or --tFolder")
+      ("intermediates",
+        po::value<string>(&ARGUMENTS.intermediatesFolder),
+        "[folder] Write the volume, the slice weights and the slice "
+        "transformations of every outer iteration to this folder.")
+      ("asyncOutput",
+        po::bool_switch(&ARGUMENTS.asyncOutput)->default_value(false),
+        "Write the output and intermediates from a background thread, .nii.gz "
+        "compressed on numThreads threads, so that the reconstruction and "
+        "the next subject of a batch do not wait for the disk")
+      ("mmapInputs",
+        po::bool_switch(&ARGUMENTS.mmapInputs)->default_value(false),
+        "Memory-map uncompressed .nii stacks and mask and convert them on "
+        "numThreads threads. Other formats are read through IRTK")
+      ("perfCounters",
+        po::bool_switch(&ARGUMENTS.perfCounters)->default_value(false),
+        "Sample cycles, instructions, LLC misses and branch misses around "
+        "every back-end kernel with perf_event. Needs --localBackends")
+      ("psfSubdivisions",
+        po::value<int>(&ARGUMENTS.psfSubdivisions)->default_value(0),
+        "Quantize the sub-voxel position of slice voxels to this many steps "
+        "per volume voxel and reuse one transformed PSF per step and slice "
+        "inside the mask, instead of resampling the PSF for every slice "
+        "voxel. Approximates the coefficients, 0 to disable. [Default: 0]")
+      ("analyticPSF",
+        po::value<double>(&ARGUMENTS.analyticPSF)->default_value(0),
+        "Before the last iteration, integrate the slice PSF analytically "
+        "over the volume voxels within this many standard deviations, "
+        "instead of resampling a sampled PSF. Smaller is faster, 0 to "
+        "disable. [Default: 0]")
       ("numThreads", 
         po::value<int>(&ARGUMENTS.numThreads)->default_value(1),
         "Number of CPU threads to run for TBB")
@@ -126,6 +224,11 @@ void parseInputParameters(int argc, char **argv) {
                   << std::endl;
       }
       po::notify(vm);
+      if (ARGUMENTS.outputName.empty() && ARGUMENTS.batchFile.empty())
+        throw po::required_option("output");
+      // The checkpoint does not keep the mask of the full resolution grid
+      if (ARGUMENTS.resume && ARGUMENTS.coarseIterations > 0)
+        throw po::error("--resume cannot be combined with --coarseIterations");
     } catch (po::error &e) {
       std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
       std::cerr << desc << std::endl;
@@ -179,8 +282,13 @@ vector<irtkRigidTransformation> getTransformations(int* templateNumber) {
   return stackTransformations;
 }
 
+void readImage(const string &name, irtkRealImage &image) {
+  if (!ARGUMENTS.mmapInputs ||
+      !ReadMappedNifti(name, image, ARGUMENTS.numThreads))
+    image.Read(name.c_str());
+}
+
 vector<irtkRealImage> getStacks(EbbRef<irtkReconstruction> reconstruction) {
-  irtkRealImage stack;
   vector<irtkRealImage> stacks;
   int nStacks = ARGUMENTS.inputStacks.size();
 
@@ -188,18 +296,38 @@ vector<irtkRealImage> getStacks(EbbRef<irtkReconstruction> reconstruction) {
     std::cout << "Reading " << nStacks << " stacks" << std::endl;
   }
 
-  for (int i = 0; i < nStacks; i++) {
-    stack.Read(ARGUMENTS.inputStacks[i].c_str());
-    stacks.push_back(stack);
-  }
+  // Stacks are independent files, read them concurrently
+  stacks.resize(nStacks);
+  task_scheduler_init init(ARGUMENTS.numThreads);
+  parallel_for(blocked_range<size_t>(0, nStacks),
+      [&stacks](const blocked_range<size_t> &r) {
+        for (size_t i = r.begin(); i != r.end(); ++i)
+          readImage(ARGUMENTS.inputStacks[i], stacks[i]);
+      });
+  init.terminate();
 
   return stacks;
 }
 
-void allocateBackends(EbbRef<irtkReconstruction> reconstruction) {
+// Every front-end of a batch talks to the same backend nodes
+void allocateBackends(vector<EbbRef<irtkReconstruction>> reconstructions) {
 
   cout << "In allocateBackends() on CPU: " << ebbrt::Cpu::GetMine() << endl; 
 
+  if (ARGUMENTS.localBackends) {
+    struct localBackendLink link;
+    link.latency = ARGUMENTS.localLatency * 1e-6;
+    link.bandwidth = ARGUMENTS.localBandwidth * 1e6;
+    if (ARGUMENTS.perfCounters)
+      EnableLocalBackendCounters();
+    for (auto reconstruction : reconstructions)
+      reconstruction->AddLocalBackends(ARGUMENTS.numBackendNodes, link);
+    return;
+  }
+
+  if (ARGUMENTS.perfCounters)
+    cout << "--perfCounters needs --localBackends, not sampling" << endl;
+
   if (ARGUMENTS.debug) {
     std::cout << "Allocating backend nodes" << std::endl;
   }
@@ -216,7 +344,7 @@ void allocateBackends(EbbRef<irtkReconstruction> reconstruction) {
   }
 
   pool_allocator->waitPool().Then(
-    [reconstruction](ebbrt::Future<void> f) {
+    [reconstructions](ebbrt::Future<void> f) {
 
     cout << "Inside pool_allocator->waitPool().Then() on CPU: " << ebbrt::Cpu::GetMine() << endl;
     f.Get();
@@ -224,7 +352,8 @@ void allocateBackends(EbbRef<irtkReconstruction> reconstruction) {
     // Store the nids into reconstruction object
     for (int i=0; i < ARGUMENTS.numBackendNodes; i++) {
       auto nid = pool_allocator->GetNidAt(i);
-      reconstruction->AddNid(nid);
+      for (auto reconstruction : reconstructions)
+        reconstruction->AddNid(nid);
     }
   });
 }
@@ -262,13 +391,14 @@ irtkRealImage* getMask(EbbRef<irtkReconstruction> reconstruction,
   irtkRealImage *mask = NULL;
 
   if (!ARGUMENTS.maskName.empty()) {
-    mask = new irtkRealImage((char *)(ARGUMENTS.maskName.c_str()));
+    mask = new irtkRealImage;
+    readImage(ARGUMENTS.maskName, *mask);
   }
   // If no mask was given  try to create mask from the template image in case it
   // was padded
   if ((mask == NULL) && (ARGUMENTS.sFolder.empty())) {
-    mask = new irtkRealImage(stacks[templateNumber]);
-    *mask = reconstruction->CreateMask(*mask);
+    mask = new irtkRealImage(
+        reconstruction->CreateMask(stacks[templateNumber]));
   }
 
   if (mask != NULL) {
@@ -294,21 +424,7 @@ void applyMask(EbbRef<irtkReconstruction> reconstruction,
     std::cout << "Applying mask" << std::endl;
   }
 
-  int nStacks = stacks.size();
-
-  // Mask is transformed to the all other stacks and they are cropped
-  for (int i = 0; i < nStacks; i++) {
-
-    // template stack has been cropped already
-    if ((i == templateNumber))
-      continue;
-    // transform the mask
-
-    irtkRealImage m = reconstruction->GetMask();
-    reconstruction->TransformMask(stacks[i], m, stackTransformations[i]);
-    // Crop template stack
-    reconstruction->CropImage(stacks[i], m);
-  }
+  reconstruction->MaskStacks(stacks, stackTransformations, templateNumber);
 }
 
 void volumetricRegistration(EbbRef<irtkReconstruction> reconstruction,
@@ -391,7 +507,8 @@ void initialReconstruction(EbbRef<irtkReconstruction> reconstruction, ebbrt::Pro
       stacks, stackTransformations, ARGUMENTS.averageValue,
       !ARGUMENTS.intensityMatching);
 
-  // Create slices and slice-dependent transformations
+  // Create slices and slice-dependent transformations. With --streamSlices
+  // they are sent to the backends one stack at a time as they are created.
   reconstruction->CreateSlicesAndTransformations(stacks, stackTransformations,
       ARGUMENTS.thickness);
 
@@ -411,6 +528,136 @@ void initialReconstruction(EbbRef<irtkReconstruction> reconstruction, ebbrt::Pro
 } 
 
 
+/*
+ * Every line of the manifest is parsed after the command line options, so
+ * that each subject only lists what differs. Empty lines and lines starting
+ * with # are skipped.
+ */
+void readBatch(int argc, char **argv) {
+  ifstream manifest(ARGUMENTS.batchFile);
+  if (!manifest) {
+    cerr << "ERROR: cannot open batch manifest " << ARGUMENTS.batchFile
+      << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  struct arguments base = ARGUMENTS;
+  string line;
+  while (getline(manifest, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    vector<string> tokens(argv, argv + argc);
+    auto subject = po::split_unix(line);
+    tokens.insert(tokens.end(), subject.begin(), subject.end());
+
+    vector<char *> subjectArgv;
+    for (auto& token : tokens)
+      subjectArgv.push_back((char *) token.c_str());
+
+    ARGUMENTS = base;
+    parseInputParameters(subjectArgv.size(), subjectArgv.data());
+    if (ARGUMENTS.outputName.empty()) {
+      cerr << "ERROR: no output for subject \"" << line << "\"" << endl;
+      exit(EXIT_FAILURE);
+    }
+    // Statistics and the metrics socket belong to a single run
+    if (!ARGUMENTS.timingsFile.empty() || !ARGUMENTS.traceFile.empty() ||
+        !ARGUMENTS.metricsSocket.empty()) {
+      cerr << "ERROR: --timings, --trace and --metricsSocket are not "
+        "supported with --batch" << endl;
+      exit(EXIT_FAILURE);
+    }
+    // Subjects sharing the --checkpoint of the command line get their own
+    if (!ARGUMENTS.checkpointFile.empty() &&
+        ARGUMENTS.checkpointFile == base.checkpointFile)
+      ARGUMENTS.checkpointFile += "." + std::to_string(SUBJECTS.size());
+    SUBJECTS.push_back(ARGUMENTS);
+  }
+  ARGUMENTS = base;
+
+  if (SUBJECTS.empty()) {
+    cerr << "ERROR: no subjects in " << ARGUMENTS.batchFile << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+ * Reconstructs the subjects of the batch one after the other on the same
+ * backends. Two front-ends take turns, so that the initial reconstruction of
+ * the next subject runs on its own core while the current one executes. The
+ * backends free the state of a subject once it is done.
+ */
+void runBatch() {
+  auto startTime = startTimer();
+
+  int cpu_num = ebbrt::Cpu::GetPhysCpus();
+  auto executeCtxt = ebbrt::Cpu::GetByIndex(_InitReconCPU)->get_context();
+  auto initReconCtxt =
+    ebbrt::Cpu::GetByIndex((_InitReconCPU + 1) % cpu_num)->get_context();
+
+  vector<EbbRef<irtkReconstruction>> reconstructions;
+  for (int i = 0; i < 2; i++) {
+    auto reconstruction = irtkReconstruction::Create();
+    reconstruction->SetParameters(ARGUMENTS);
+    reconstructions.push_back(reconstruction);
+  }
+
+  auto beforeAllocation = startTimer();
+  allocateBackends(reconstructions);
+
+  vector<std::unique_ptr<ebbrt::Promise<float>>> initialized;
+  auto initialize = [&](int subject) {
+    auto reconstruction = reconstructions[subject % 2];
+    reconstruction->Reset();
+    // initialReconstruction() reads the options of the subject from ARGUMENTS
+    ARGUMENTS = SUBJECTS[subject];
+    initialized.emplace_back(new ebbrt::Promise<float>);
+    auto promise = initialized.back().get();
+    auto future = promise->GetFuture();
+    ebbrt::event_manager->SpawnRemote([reconstruction, promise]() {
+      initialReconstruction(reconstruction, promise);
+    }, initReconCtxt);
+    return future;
+  };
+
+  auto initialReconstructionFut = initialize(0);
+
+  for (auto reconstruction : reconstructions)
+    reconstruction->WaitPool().Block().Get();
+  cout << "[Allocation time] " << endTimer(beforeAllocation) << endl;
+
+  for (int i = 0; i < (int) SUBJECTS.size(); i++) {
+    auto reconstruction = reconstructions[i % 2];
+    auto initialReconstructionSeconds = initialReconstructionFut.Block().Get();
+
+    auto done = reconstruction->ReconstructionDone();
+    auto subjectStart = startTimer();
+    ebbrt::event_manager->SpawnRemote([reconstruction]() {
+      reconstruction->Execute();
+    }, executeCtxt);
+
+    if (i + 1 < (int) SUBJECTS.size())
+      initialReconstructionFut = initialize(i + 1);
+
+    done.Block().Get();
+    reconstruction->ReleaseBackends();
+
+    cout << "[Subject " << i << "] " << SUBJECTS[i].outputName << endl;
+    cout << "[Subject " << i << " initial reconstruction time] "
+      << initialReconstructionSeconds << endl;
+    cout << "[Subject " << i << " reconstruction time] "
+      << endTimer(subjectStart) << endl;
+    reconstruction->PrintImageSums("[checksum]");
+  }
+
+  for (auto reconstruction : reconstructions)
+    reconstruction->WaitForOutput();
+
+  cout << "[Total batch time] " << endTimer(startTime) << endl;
+  ebbrt::Cpu::Exit(EXIT_SUCCESS);
+}
+
 void AppMain() {
 
   auto startTime = startTimer();
@@ -422,8 +669,15 @@ void AppMain() {
  
   cout << "Starting the App on CPU: " << _FeIOCPU << endl;
 
+  if (!SUBJECTS.empty()) {
+    runBatch();
+    return;
+  }
+
   auto reconstruction = irtkReconstruction::Create();
-  allocateBackends(reconstruction);
+  if (!ARGUMENTS.metricsSocket.empty())
+    reconstruction->StartMetrics(ARGUMENTS.metricsSocket);
+  allocateBackends({reconstruction});
 
   // to capture the Init Recon time
   auto finishedInitRecon = new ebbrt::Promise<float>;
@@ -470,6 +724,22 @@ void AppMain() {
     cout << "[Initial reconstruction time] " << initialReconstructionSeconds << endl;
     cout << "[Total reconstruction time] " << seconds << endl;
     reconstruction->PrintImageSums("[checksum]");
+
+    if (!ARGUMENTS.traceFile.empty())
+      reconstruction->WriteTrace(ARGUMENTS.traceFile);
+
+    if (!ARGUMENTS.timingsFile.empty()) {
+      reconstruction->WriteTimers(ARGUMENTS.timingsFile);
+      ofstream timings(ARGUMENTS.timingsFile, ios::app);
+      WriteTotalData(timings, "allocation", allocationTime);
+      WriteTotalData(timings, "initialReconstruction",
+          initialReconstructionSeconds);
+      WriteTotalData(timings, "reconstruction", seconds);
+    }
+
+    reconstruction->WaitForOutput();
+    reconstruction->StopMetrics();
+
     //TODO: uncomment this line once everything works.
     ebbrt::Cpu::Exit(EXIT_SUCCESS);
   });
@@ -480,6 +750,8 @@ int main(int argc, char **argv) {
 
   EXEC_NAME = argv[0];
   parseInputParameters(argc, argv);
+  if (!ARGUMENTS.batchFile.empty())
+    readBatch(argc, argv);
 
   pthread_t tid = ebbrt::Cpu::EarlyInit((size_t) ARGUMENTS.numFrontendCPUs);
   pthread_join(tid, &status);
@@ -6,6 +6,7 @@
 #include "../utils.h"
 
 #include "irtkReconstruction.h"
+#include "mappedNifti.h"
 
 #include <ebbrt/Cpu.h>
 #include <ebbrt/hosted/PoolAllocator.h>
@@ -13,6 +14,8 @@
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 
+#include <fstream>
+
 using namespace ebbrt;
 using namespace std;
 
@@ -20,6 +23,9 @@ namespace po = boost::program_options;
 
 struct arguments ARGUMENTS;
 
+// Options of every subject of a batch (--batch)
+vector<struct arguments> SUBJECTS;
+
 size_t _FeIOCPU;
 
 size_t _InitReconCPU;
@@ -30,9 +36,15 @@ void parseInputParameters(int argc, char **argv);
 
 vector<irtkRigidTransformation> getTransformations(int* templateNumber);
 
+void readImage(const string &name, irtkRealImage &image);
+
 vector<irtkRealImage> getStacks(EbbRef<irtkReconstruction> reconstruction);
 
-void allocateBackends(EbbRef<irtkReconstruction> reconstruction);
+void allocateBackends(vector<EbbRef<irtkReconstruction>> reconstructions);
+
+void readBatch(int argc, char **argv);
+
+void runBatch();
 
 void initializeThikness(vector<irtkRealImage> stacks);
 
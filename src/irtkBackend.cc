@@ -0,0 +1,2529 @@
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include "irtkBackend.h"
+#include <irtkRegistration.h>
+#include <irtkImageRigidRegistration.h>
+#include <irtkImageRigidRegistrationWithPadding.h>
+
+#ifndef __EBBRT_BM__
+#include <condition_variable>
+#include <thread>
+
+#include "hosted/perfCounters.h"
+#endif
+
+#pragma GCC diagnostic ignored "-Wsign-compare"
+
+static ebbrt::SpinLock spinLock;
+
+#ifndef __EBBRT_BM__
+typedef std::function<void(size_t worker, PerfCounters& counters)>
+  WorkerFunction;
+
+// Threads of an in-process backend that live as long as its pool of workers.
+// Each opens its hardware counters once, so that a ParallelFor() only resets
+// and reads them.
+class WorkerThreads {
+  public:
+    WorkerThreads(size_t workers, bool counters) {
+      for (size_t worker = 0; worker < workers; worker++)
+        _threads.emplace_back([this, worker, counters]() {
+          Loop(worker, counters);
+        });
+    }
+
+    ~WorkerThreads() {
+      {
+        std::lock_guard<std::mutex> l(_m);
+        _stop = true;
+      }
+      _wake.notify_all();
+      for (auto& thread : _threads)
+        thread.join();
+    }
+
+    size_t Size() { return _threads.size(); }
+
+    // Runs work(worker, counters) on every thread and returns once all of
+    // them are done
+    void Run(WorkerFunction work) {
+      std::lock_guard<std::mutex> run(_runMutex);
+      std::unique_lock<std::mutex> l(_m);
+      _work = std::move(work);
+      _pending = _threads.size();
+      _generation++;
+      _wake.notify_all();
+      _done.wait(l, [this]() { return _pending == 0; });
+      _work = nullptr;
+    }
+
+  private:
+    void Loop(size_t worker, bool enabled) {
+      PerfCounters counters(enabled);
+      uint64_t generation = 0;
+      std::unique_lock<std::mutex> l(_m);
+      while (true) {
+        _wake.wait(l, [&]() { return _stop || _generation != generation; });
+        if (_stop)
+          return;
+        generation = _generation;
+
+        l.unlock();
+        _work(worker, counters);
+        l.lock();
+
+        if (--_pending == 0)
+          _done.notify_one();
+      }
+    }
+
+    std::vector<std::thread> _threads;
+    std::mutex _runMutex;
+    std::mutex _m;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    WorkerFunction _work;
+    uint64_t _generation{0};
+    size_t _pending{0};
+    bool _stop{false};
+};
+#endif
+
+irtkBackend::irtkBackend(BackendReplyFunction reply)
+  : _reply(std::move(reply)) {}
+
+irtkBackend::~irtkBackend() {}
+
+void irtkBackend::SendToFrontEnd(Messenger::NetworkId frontEndNid,
+    std::unique_ptr<ebbrt::IOBuf>&& buf) {
+  // Every message starts with the function it belongs to
+  auto fn = *(const int*) buf->Data();
+  auto len = buf->ComputeChainDataLength();
+  auto now = TimerNow();
+  Trace(TRACE_SEND, fn, 0, len, now, now);
+
+  auto& message = _messages[MessageType(fn)];
+  message.sent++;
+  message.sentBytes += len;
+  message.serialize += TakeSerializeTime();
+  _reply(frontEndNid, std::move(buf));
+}
+
+void irtkBackend::Trace(uint32_t type, int phase, uint32_t thread,
+    uint32_t bytes, uint64_t begin, uint64_t end) {
+  if (!_traceEnabled)
+    return;
+
+  struct trace_event event;
+  event.type = type;
+  event.phase = phase;
+  event.thread = thread;
+  event.bytes = bytes;
+  event.begin = begin;
+  event.end = end;
+
+  std::lock_guard<std::mutex> l(_traceMutex);
+  _trace.push_back(event);
+}
+
+void irtkBackend::RunOnIOCPU(std::function<void()> fn) {
+#ifdef __EBBRT_BM__
+  ebbrt::event_manager->SpawnRemote(std::move(fn), _IOCPU);
+#else
+  fn();
+#endif
+}
+
+/*
+ * Runs kernel(start, end) on every worker, each over its share of
+ * [_start, _end), and returns once all of them are done
+ */
+void irtkBackend::ParallelFor(int phase,
+    std::function<void(int start, int end)> kernel) {
+  // Each worker is idle for the part of the call it does not spend in its
+  // share of the kernel
+  vector<uint64_t> busy(_workers.size(), 0);
+  auto callStart = TimerNow();
+
+#ifdef __EBBRT_BM__
+  size_t mainCPU = ebbrt::Cpu::GetMine();
+  ebbrt::EventManager::EventContext context;
+  std::atomic<size_t> count(0);
+
+  for (size_t workerIndex = 0; workerIndex < _workers.size(); workerIndex++) {
+
+    auto workerId = _workers.at(workerIndex);
+
+    ebbrt::event_manager->SpawnRemote(
+      [this, &context, &count, &kernel, &busy, mainCPU, workerIndex,
+       phase]() {
+
+      int start = workerIndex * _factor + _start;
+      int end = start + _factor; 
+      end = end > _end ? _end : end;
+
+      auto begin = TimerNow();
+      kernel(start, end);
+      auto finish = TimerNow();
+      busy[workerIndex] = finish - begin;
+      Trace(TRACE_WORKER, phase, workerIndex + 1, 0, begin, finish);
+
+      count++;
+      _barrier->Wait();
+      while(count < _workers.size()); 
+      if (ebbrt::Cpu::GetMine() == mainCPU)
+        ebbrt::event_manager->ActivateContext(std::move(context));
+    }, workerId);
+  }
+  ebbrt::event_manager->SaveContext(context);
+#else
+  vector<struct counter_data> counted(_workers.size());
+
+  _threads->Run([this, &kernel, &busy, &counted, phase](size_t workerIndex,
+        PerfCounters& counters) {
+    int start = workerIndex * _factor + _start;
+    int end = start + _factor; 
+    end = end > _end ? _end : end;
+
+    if (start >= end)
+      return;
+
+    auto begin = TimerNow();
+    counters.Start();
+    kernel(start, end);
+    counters.Stop(counted[workerIndex]);
+    auto finish = TimerNow();
+    busy[workerIndex] = finish - begin;
+    Trace(TRACE_WORKER, phase, workerIndex + 1, 0, begin, finish);
+  });
+
+  for (auto& c : counted) {
+    _counters[phase].cycles += c.cycles;
+    _counters[phase].instructions += c.instructions;
+    _counters[phase].cacheMisses += c.cacheMisses;
+    _counters[phase].branchMisses += c.branchMisses;
+  }
+#endif
+
+  auto elapsed = TimerNow() - callStart;
+  for (size_t workerIndex = 0; workerIndex < _workers.size(); workerIndex++) {
+    _worker_performance[workerIndex][phase].busy += busy[workerIndex];
+    _worker_performance[workerIndex][phase].idle +=
+      elapsed - busy[workerIndex];
+  }
+}
+
+void irtkBackend::ResetOrigin(
+    irtkGreyImage &image, irtkRigidTransformation &transformation) {
+  double ox, oy, oz;
+  image.GetOrigin(ox, oy, oz);
+  image.PutOrigin(0, 0, 0);
+  transformation.PutTranslationX(ox);
+  transformation.PutTranslationY(oy);
+  transformation.PutTranslationZ(oz);
+  transformation.PutRotationX(0);
+  transformation.PutRotationY(0);
+  transformation.PutRotationZ(0);
+}
+
+void irtkBackend::ResetOrigin(
+    irtkRealImage &image, irtkRigidTransformation &transformation) {
+  double ox, oy, oz;
+  image.GetOrigin(ox, oy, oz);
+  image.PutOrigin(0, 0, 0);
+  transformation.PutTranslationX(ox);
+  transformation.PutTranslationY(oy);
+  transformation.PutTranslationZ(oz);
+  transformation.PutRotationX(0);
+  transformation.PutRotationY(0);
+  transformation.PutRotationZ(0);
+}
+
+/*
+ * CoeffInit functions
+ */
+
+void printCoeffInitParameters(struct coeffInitParameters parameters) {
+  cout << "[CoeffInit input] stackFactor: " << parameters.stackFactor << endl;
+  cout << "[CoeffInit input] stackIndex: " << parameters.stackIndex << endl;
+  cout << "[CoeffInit input] delta: " << parameters.delta << endl;
+  cout << "[CoeffInit input] lambda: " << parameters.lambda << endl;
+  cout << "[CoeffInit input] alpha: " << parameters.alpha << endl;
+  cout << "[CoeffInit input] qualityFactor: " << parameters.qualityFactor << endl;
+  cout << "[CoeffInit input] psfRadius: " << parameters.psfRadius << endl;
+}
+
+void printReconstructionParameters(struct reconstructionParameters parameters) {
+  cout << "[CoeffInit input] Global Bias Correction: " << parameters.globalBiasCorrection << endl;
+  cout << "[CoeffInit input] start: " << parameters.start << endl;
+  cout << "[CoeffInit input] end: " << parameters.end << endl;
+  cout << "[CoeffInit input] Adaptive: " << parameters.adaptive << endl;
+  cout << "[CoeffInit input] Sigma Bias: " << parameters.sigmaBias << endl;
+  cout << "[CoeffInit input] Step: " << parameters.step << endl;
+  cout << "[CoeffInit input] Sigma SCPU: " << parameters.sigmaSCPU << endl;
+  cout << "[CoeffInit input] Sigma S2CPU: " << parameters.sigmaS2CPU << endl;
+  cout << "[CoeffInit input] Mix SCPU: " << parameters.mixSCPU << endl;
+  cout << "[CoeffInit input] Mix CPU: " << parameters.mixCPU << endl;
+  cout << "[CoeffInit input] Low Intensity Cutoff" << parameters.lowIntensityCutoff << endl;
+  cout << "[CoeffInit input] PSF Subdivisions: " << parameters.psfSubdivisions << endl;
+}
+
+void irtkBackend::StoreParameters(
+    struct reconstructionParameters parameters) {
+
+  _globalBiasCorrection = parameters.globalBiasCorrection;
+  _adaptive = parameters.adaptive;
+  _traceEnabled = parameters.trace;
+  _sigmaBias = parameters.sigmaBias;
+  _step = parameters.step;
+  _sigmaSCPU = parameters.sigmaSCPU;
+  _sigmaS2CPU = parameters.sigmaS2CPU;
+  _mixSCPU = parameters.mixSCPU;
+  _mixCPU = parameters.mixCPU;
+  _lowIntensityCutoff = parameters.lowIntensityCutoff;
+  _numThreads = parameters.numThreads;
+  _psfSubdivisions = parameters.psfSubdivisions;
+
+  for (int i = 0; i < 13; i++)
+    for (int j = 0; j < 3; j++)
+      _directions[i][j] = parameters.directions[i][j];
+}
+
+void irtkBackend::SetSliceRange(int start, int end) {
+  _start = start;
+  _end = end;
+  _factor = (int) ceil((_end - _start) / (float) _workers.size());
+}
+
+void irtkBackend::StoreCoeffInitParameters(
+    ebbrt::IOBuf::DataPointer& dp) {
+  
+  auto parameters = dp.Get<struct coeffInitParameters>();
+  if (_debug)
+    printCoeffInitParameters(parameters);
+  
+  _delta = parameters.delta;
+  _lambda = parameters.lambda;
+  _qualityFactor = parameters.qualityFactor;
+  _psfRadius = parameters.psfRadius;
+}
+
+void irtkBackend::DefineWorkers() {
+  // Bootstrapped again for every subject of a batch
+  _workers.clear();
+
+  for (size_t worker = 0; worker < _numThreads; worker++) {
+#ifdef __EBBRT_BM__
+    // In-process backends do their IO on the front-end's cores
+    if (worker == _IOCPU) {
+      if (_debug) 
+        cout << "Core #" << worker << " reserved for IO" << endl;
+      continue;
+    }
+#endif
+
+    _workers.push_back(worker);
+    if (_debug) 
+      cout << "Core #" << worker << " added to the pool of workers" << endl;
+  }
+
+  _worker_performance.resize(_workers.size());
+
+  // Workers leaving the barrier of the last ParallelFor() may still read it,
+  // it is only replaced when the number of workers changes
+  if (!_barrier || _barrierSize != _workers.size()) {
+    _barrier.reset(new ebbrt::SpinBarrier(_workers.size()));
+    _barrierSize = _workers.size();
+  }
+
+#ifndef __EBBRT_BM__
+  if (!_threads || _threads->Size() != _workers.size())
+    _threads.reset(new WorkerThreads(_workers.size(), _perfCounters));
+#endif
+}
+
+/*
+ * Without streamed, the message also holds the slices of this backend and
+ * the transformations and stack indices of all slices. With it these follow
+ * in COEFF_INIT_STREAM_SLICES messages.
+ */
+void irtkBackend::CoeffInitBootstrap(ebbrt::IOBuf::DataPointer& dp, 
+    size_t cpu, bool streamed) {
+
+  cout << "In CoeffInitBootstrap() with IO_CPU " << cpu << endl;
+
+  auto parameters = dp.Get<struct coeffInitParameters>();
+  auto reconstructionParameters = dp.Get<struct reconstructionParameters>();
+
+  _debug = parameters.debug;
+  _IOCPU = cpu;
+
+  if (_debug) {
+    printCoeffInitParameters(parameters);
+    printReconstructionParameters(reconstructionParameters);
+  }
+
+  _delta = parameters.delta;
+  _lambda = parameters.lambda;
+  _qualityFactor = parameters.qualityFactor;
+  _psfRadius = parameters.psfRadius;
+
+  StoreParameters(reconstructionParameters);
+
+  DefineWorkers();
+
+  SetSliceRange(reconstructionParameters.start, reconstructionParameters.end);
+
+  int stackFactorSize = parameters.stackFactor;
+  int stackIndexSize = parameters.stackIndex;
+
+  auto nSlices = dp.Get<int>();
+  _slices.resize(nSlices);
+
+  if (!streamed) {
+    for (int i = _start; i < _end; i++) {
+      deserializeSlice(dp, _slices[i]);
+    }
+  }
+
+  deserializeSlice(dp, _reconstructed);
+  deserializeSlice(dp, _mask);
+
+  if (streamed) {
+    _stackFactor.resize(stackFactorSize);
+    dp.Get(stackFactorSize*sizeof(float), (uint8_t*)_stackFactor.data());
+
+    _transformations.clear();
+    _transformations.resize(nSlices);
+    _stackIndex.clear();
+    _stackIndex.resize(nSlices);
+
+    _volcoeffs.clear();
+    _volcoeffs.resize(_slices.size());
+    _sliceInsideCPU.clear();
+    _sliceInsideCPU.resize(_slices.size());
+    return;
+  }
+
+  auto nRigidTrans = dp.Get<int>();	
+  _transformations.resize(nRigidTrans);
+  for(int i = 0; i < nRigidTrans; i++) {
+    deserializeTransformations(dp, _transformations[i]);
+  }
+
+  _stackFactor.resize(stackFactorSize);
+  dp.Get(stackFactorSize*sizeof(float), (uint8_t*)_stackFactor.data());
+
+  _stackIndex.resize(stackIndexSize);
+  dp.Get(stackIndexSize*sizeof(int), (uint8_t*)_stackIndex.data());
+  
+  InitializeEM();
+  
+  _voxelNum.resize(_slices.size());
+}
+
+// Coefficients of the slices are computed as soon as they arrive
+void irtkBackend::CoeffInitSlices(ebbrt::IOBuf::DataPointer& dp) {
+  int start = dp.Get<int>();
+  int end = dp.Get<int>();
+  // Count written by serializeSlices(), given by the range
+  dp.Advance(sizeof(int));
+
+  for (int i = start; i < end; i++) {
+    deserializeSlice(dp, _slices[i]);
+  }
+
+  auto nRigidTrans = dp.Get<int>();
+  for (int i = start; i < end; i++) {
+    deserializeTransformations(dp, _transformations[i]);
+  }
+
+  dp.Get((end - start) * sizeof(int), (uint8_t*)(_stackIndex.data() + start));
+
+  int first = _start;
+  int last = _end;
+  SetSliceRange(start, end);
+  ParallelCoeffInit();
+  SetSliceRange(first, last);
+}
+
+void irtkBackend::InitializeEMValues() {
+  for (int i = _start; i < _end; i++) {
+    // [fetalRecontruction] Initialize voxel weights and bias values
+    irtkRealPixel *pw = _weights[i].GetPointerToVoxels();
+    irtkRealPixel *pb = _bias[i].GetPointerToVoxels();
+    irtkRealPixel *pi = _slices[i].GetPointerToVoxels();
+    for (int j = 0; j < _weights[i].GetNumberOfVoxels(); j++) {
+      if (*pi != -1) {
+        *pw = 1;
+        *pb = 0;
+      } else {
+        *pw = 0;
+        *pb = 0;
+      }
+      pi++;
+      pw++;
+      pb++;
+    }
+    // [fetalRecontruction] Initialize slice weights
+    _sliceWeightCPU[i] = 1;
+    // [fetalRecontruction] Initialize scaling factors for intensity matching
+    _scaleCPU[i] = 1;
+  }
+}
+
+void irtkBackend::InitializeEM() {
+  _weights.resize(_slices.size());
+  _bias.resize(_slices.size());
+  _scaleCPU.resize(_slices.size());
+  _sliceWeightCPU.resize(_slices.size());
+  _slicePotential.resize(_slices.size());
+
+  for (int i = _start; i < _end; i++) {
+    // [fetalRecontruction] Create images for voxel weights and bias fields
+    _weights[i] = _slices[i];
+    _bias[i] = _slices[i];
+    // [fetalRecontruction] Create and initialize scales
+    _scaleCPU[i] = 1;
+    // [fetalRecontruction] Create and initialize slice weights
+    _sliceWeightCPU[i] = 1;
+    _slicePotential[i] = 0;
+  }
+
+  // [fetalRecontruction] Find the range of intensities
+  _maxIntensity = voxel_limits<irtkRealPixel>::min();
+  _minIntensity = voxel_limits<irtkRealPixel>::max();
+  for (unsigned int i = _start; i < _end; i++) {
+    // [fetalRecontruction] to update minimum we need to exclude padding value
+    irtkRealPixel *ptr = _slices[i].GetPointerToVoxels();
+    for (int ind = 0; ind < _slices[i].GetNumberOfVoxels(); ind++) {
+      if (*ptr > 0) {
+        if (*ptr > _maxIntensity)
+          _maxIntensity = *ptr;
+        if (*ptr < _minIntensity)
+          _minIntensity = *ptr;
+      }
+      ptr++;
+    }
+  }
+}
+
+/*
+ * Coefficients of a slice from the PSF integrated over the volume voxels.
+ * The slice PSF is a Gaussian in the slice frame. In volume voxel
+ * coordinates its covariance is rotated and scaled, and integrating it over
+ * a voxel is approximated by adding the variance of the voxel, 1/12 per
+ * axis. Voxels beyond _psfRadius standard deviations are dropped, and so
+ * are voxels outside the mask ROI. The PSF is normalized over the rest, so
+ * unlike the sampled PSF, which keeps all 8 neighbours of a sample that
+ * touches the ROI, no coefficient falls outside it.
+ */
+void irtkBackend::AnalyticCoeffInit(int index) {
+  irtkRealImage& slice = _slices[index];
+  bool sliceInside = false;
+
+  POINT3D p;
+  VOXELCOEFFS empty;
+  SLICECOEFFS slicecoeffs(slice.GetX(),
+      vector < VOXELCOEFFS >(slice.GetY(), empty));
+
+  double dx, dy, dz;
+  slice.GetPixelSize(&dx, &dy, &dz);
+  double d[3] = {dx, dy, dz};
+  double sigma[3] = {1.2 * dx / 2.3548, 1.2 * dy / 2.3548, dz / 2.3548};
+
+  //slice image coordinates to volume image coordinates
+  irtkMatrix toVolume = _reconstructed.GetWorldToImageMatrix() *
+    _transformations[index].GetMatrix() * slice.GetImageToWorldMatrix();
+  double t[3][4];
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 4; c++)
+      t[r][c] = toVolume(r, c);
+
+  //covariance of the PSF in volume voxels
+  double cov[3][3];
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++) {
+      cov[r][c] = (r == c) ? 1.0 / 12 : 0;
+      for (int k = 0; k < 3; k++)
+        cov[r][c] += t[r][k] * t[c][k] * sigma[k] * sigma[k] / (d[k] * d[k]);
+    }
+
+  //its inverse
+  double inv[3][3];
+  inv[0][0] = cov[1][1] * cov[2][2] - cov[1][2] * cov[2][1];
+  inv[0][1] = cov[0][2] * cov[2][1] - cov[0][1] * cov[2][2];
+  inv[0][2] = cov[0][1] * cov[1][2] - cov[0][2] * cov[1][1];
+  inv[1][1] = cov[0][0] * cov[2][2] - cov[0][2] * cov[2][0];
+  inv[1][2] = cov[0][2] * cov[1][0] - cov[0][0] * cov[1][2];
+  inv[2][2] = cov[0][0] * cov[1][1] - cov[0][1] * cov[1][0];
+  double det = cov[0][0] * inv[0][0] + cov[0][1] * inv[0][1] + 
+    cov[0][2] * inv[0][2];
+  for (int r = 0; r < 3; r++)
+    for (int c = r; c < 3; c++) {
+      inv[r][c] /= det;
+      inv[c][r] = inv[r][c];
+    }
+
+  //half widths of the box holding the truncated PSF
+  double radius2 = _psfRadius * _psfRadius;
+  int ex = ceil(_psfRadius * sqrt(cov[0][0]));
+  int ey = ceil(_psfRadius * sqrt(cov[1][1]));
+  int ez = ceil(_psfRadius * sqrt(cov[2][2]));
+
+  int volX = _reconstructed.GetX();
+  int volY = _reconstructed.GetY();
+  int volZ = _reconstructed.GetZ();
+
+  for (int i = 0; i < slice.GetX(); i++)
+    for (int j = 0; j < slice.GetY(); j++)
+      if (slice(i, j, 0) != -1) {
+        //centrepoint of slice voxel in volume space
+        double bx = t[0][0] * i + t[0][1] * j + t[0][3];
+        double by = t[1][0] * i + t[1][1] * j + t[1][3];
+        double bz = t[2][0] * i + t[2][1] * j + t[2][3];
+        int tx = round(bx);
+        int ty = round(by);
+        int tz = round(bz);
+
+        VOXELCOEFFS& coeffs = slicecoeffs[i][j];
+        double sum = 0;
+        for (int l = max(0, tx - ex); l <= min(volX - 1, tx + ex); l++)
+          for (int m = max(0, ty - ey); m <= min(volY - 1, ty + ey); m++)
+            for (int n = max(0, tz - ez); n <= min(volZ - 1, tz + ez); n++) {
+              double x = l - bx;
+              double y = m - by;
+              double z = n - bz;
+              double d2 = inv[0][0] * x * x + inv[1][1] * y * y +
+                inv[2][2] * z * z + 2 * (inv[0][1] * x * y +
+                    inv[0][2] * x * z + inv[1][2] * y * z);
+              if ((d2 > radius2) || (_mask(l, m, n) != 1))
+                continue;
+
+              p.index = _reconstructed.VoxelToIndex(l, m, n);
+              p.value = exp(-0.5 * d2);
+              sum += p.value;
+              coeffs.push_back(p);
+            }
+
+        //as with the sampled PSF, slice voxels that miss the mask ROI have
+        //no coefficients
+        if (sum <= 0) {
+          coeffs.clear();
+          continue;
+        }
+        sliceInside = true;
+        for (auto& c : coeffs)
+          c.value /= sum;
+      }
+
+  _volcoeffs[index] = slicecoeffs;
+  _sliceInsideCPU[index] = sliceInside;
+}
+
+void irtkBackend::ParallelCoeffInit() {
+  ParallelFor(COEFF_INIT, [this](int start, int end) {
+    for (size_t index = start; (int) index < end; ++index) {
+
+      if (_psfRadius > 0) {
+        AnalyticCoeffInit(index);
+        continue;
+      }
+
+      bool sliceInside;
+
+      //get resolution of the volume
+      double vx, vy, vz;
+      _reconstructed.GetPixelSize(&vx, &vy, &vz);
+      //volume is always isotropic
+      double res = vx;
+
+      //read the slice
+      irtkRealImage& slice = _slices[index];
+
+      //prepare structures for storage
+      POINT3D p;
+      VOXELCOEFFS empty;
+      SLICECOEFFS slicecoeffs(slice.GetX(),
+          vector < VOXELCOEFFS >(slice.GetY(), empty));
+
+      //to check whether the slice has an overlap with mask ROI
+      sliceInside = false;
+
+      //PSF will be calculated in slice space in higher resolution
+
+      //get slice voxel size to define PSF
+      double dx, dy, dz;
+      slice.GetPixelSize(&dx, &dy, &dz);
+
+      //sigma of 3D Gaussian (sinc with FWHM=dx or dy in-plane, 
+      //Gaussian with FWHM = dz through-plane)
+      double sigmax = 1.2 * dx / 2.3548;
+      double sigmay = 1.2 * dy / 2.3548;
+      double sigmaz = dz / 2.3548;
+
+      //calculate discretized PSF
+      //isotropic voxel size of PSF - derived from resolution of 
+      //reconstructed volume
+      double size = res / _qualityFactor;
+
+      //number of voxels in each direction
+      //the ROI is 2*voxel dimension
+
+      int xDim = round(2 * dx / size);
+      int yDim = round(2 * dy / size);
+      int zDim = round(2 * dz / size);
+
+      //image corresponding to PSF
+      irtkImageAttributes attr;
+      attr._x = xDim;
+      attr._y = yDim;
+      attr._z = zDim;
+      attr._dx = size;
+      attr._dy = size;
+      attr._dz = size;
+      irtkRealImage PSF(attr);
+
+      //centre of PSF
+      double cx, cy, cz;
+      cx = 0.5 * (xDim - 1);
+      cy = 0.5 * (yDim - 1);
+      cz = 0.5 * (zDim - 1);
+      PSF.ImageToWorld(cx, cy, cz);
+
+      //slice image coordinates to volume image coordinates, composed once
+      //per slice instead of ImageToWorld, Transform and WorldToImage per
+      //PSF sample
+      irtkMatrix toVolume = _reconstructed.GetWorldToImageMatrix() *
+        _transformations[index].GetMatrix() * slice.GetImageToWorldMatrix();
+      double t[3][4];
+      for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+          t[r][c] = toVolume(r, c);
+
+      //PSF samples, flattened in (i, j, k) order: their values and their
+      //offsets in volume image coordinates from the centre of a slice voxel
+      int nSamples = xDim * yDim * zDim;
+      vector<double> psf(nSamples);
+      vector<double> ox(nSamples), oy(nSamples), oz(nSamples);
+
+      double x, y, z;
+      double sum = 0;
+      int i, j, k;
+      int s = 0;
+      for (i = 0; i < xDim; i++)
+        for (j = 0; j < yDim; j++)
+          for (k = 0; k < zDim; k++, s++) {
+            x = i;
+            y = j;
+            z = k;
+            PSF.ImageToWorld(x, y, z);
+            x -= cx;
+            y -= cy;
+            z -= cz;
+            //continuous PSF does not need to be normalized as discrete will be
+            psf[s] = exp(
+                -x * x / (2 * sigmax * sigmax) - y * y / (2 * sigmay * sigmay)
+                - z * z / (2 * sigmaz * sigmaz));
+            sum += psf[s];
+
+            //Need to convert (x,y,z) to slice image coordinates because
+            //slices can have transformations included in them (they are
+            //nifti) and those are not reflected in PSF. In slice image
+            //coordinates we are sure that z is through-plane 
+            x /= dx;
+            y /= dy;
+            z /= dz;
+            ox[s] = t[0][0] * x + t[0][1] * y + t[0][2] * z;
+            oy[s] = t[1][0] * x + t[1][1] * y + t[1][2] * z;
+            oz[s] = t[2][0] * x + t[2][1] * y + t[2][2] * z;
+          }
+      for (s = 0; s < nSamples; s++)
+        psf[s] /= sum;
+
+      //prepare storage for PSF transformed and resampled to the space of
+      //reconstructed volume maximum dim of rotated kernel - the next higher odd
+      //integer plus two to accound for rounding error of tx,ty,tz.  Note
+      //conversion from PSF image coordinates to tPSF image coordinates *size/res
+
+      int dim = (floor(ceil(sqrt(double(xDim * xDim + yDim * yDim + zDim * zDim)) 
+              * size / res) / 2)) * 2 + 1 + 2;
+      //prepare image attributes. Voxel dimension will be taken from the
+      //reconstructed volume
+      attr._x = dim;
+      attr._y = dim;
+      attr._z = dim;
+      attr._dx = res;
+      attr._dy = res;
+      attr._dz = res;
+      //create matrix from transformed PSF
+      irtkRealImage tPSF(attr);
+      //calculate centre of tPSF in image coordinates
+      int centre = (dim - 1) / 2;
+
+      //lowest corner of the cube of the 8 closest volume voxels and the
+      //fractional position inside it, for every PSF sample
+      vector<int> nxs(nSamples), nys(nSamples), nzs(nSamples);
+      vector<double> fxs(nSamples), fys(nSamples), fzs(nSamples);
+
+      int volX = _reconstructed.GetX();
+      int volY = _reconstructed.GetY();
+      int volZ = _reconstructed.GetZ();
+
+      //PSF templates of this slice, one per quantized sub-voxel offset of
+      //the slice voxel centre, built when first needed
+      int subdivisions = _psfSubdivisions;
+      int nTemplates = subdivisions * subdivisions * subdivisions;
+      struct PSFTAP {
+        short x, y, z;
+        float value;
+      };
+      vector<vector<PSFTAP>> templates(nTemplates);
+      vector<bool> built(nTemplates, false);
+
+      //transformed PSF of a slice voxel centred at (qx,qy,qz) relative to
+      //its nearest volume voxel, without masking. The weights of the 8
+      //neighbours of a sample sum to one, so no normalization is needed
+      auto buildTemplate = [&](double qx, double qy, double qz,
+          vector<PSFTAP>& kernel) {
+        vector<double> dense(dim * dim * dim, 0);
+        for (int s = 0; s < nSamples; s++) {
+          double px = qx + ox[s];
+          double py = qy + oy[s];
+          double pz = qz + oz[s];
+          int lx = (int)floor(px);
+          int ly = (int)floor(py);
+          int lz = (int)floor(pz);
+          double wx[2] = {1 - (px - lx), px - lx};
+          double wy[2] = {1 - (py - ly), py - ly};
+          double wz[2] = {1 - (pz - lz), pz - lz};
+          for (int l = 0; l < 2; l++)
+            for (int m = 0; m < 2; m++)
+              for (int n = 0; n < 2; n++) {
+                int aa = lx + l + centre;
+                int bb = ly + m + centre;
+                int cc = lz + n + centre;
+                if ((aa < 0) || (aa >= dim) || (bb < 0) || (bb >= dim) ||
+                    (cc < 0) || (cc >= dim)) {
+                  cerr << "Error while trying to populate PSF template. "
+                    << aa << " " << bb << " " << cc << endl;
+                  exit(1);
+                }
+                dense[(aa * dim + bb) * dim + cc] +=
+                  psf[s] * wx[l] * wy[m] * wz[n];
+              }
+        }
+
+        PSFTAP e;
+        for (int aa = 0; aa < dim; aa++)
+          for (int bb = 0; bb < dim; bb++)
+            for (int cc = 0; cc < dim; cc++)
+              if (dense[(aa * dim + bb) * dim + cc] > 0) {
+                e.x = aa - centre;
+                e.y = bb - centre;
+                e.z = cc - centre;
+                e.value = dense[(aa * dim + bb) * dim + cc];
+                kernel.push_back(e);
+              }
+      };
+
+      //for each voxel in current slice calculate matrix coefficients
+      int ii, jj, kk;
+      int tx, ty, tz;
+      int nx, ny, nz;
+      int l, m, n;
+      double weight;
+      for (i = 0; i < slice.GetX(); i++)
+        for (j = 0; j < slice.GetY(); j++)
+          if (slice(i, j, 0) != -1) {
+            //calculate centrepoint of slice voxel in volume space (tx,ty,tz)
+            double bx = t[0][0] * i + t[0][1] * j + t[0][3];
+            double by = t[1][0] * i + t[1][1] * j + t[1][3];
+            double bz = t[2][0] * i + t[2][1] * j + t[2][3];
+            tx = round(bx);
+            ty = round(by);
+            tz = round(bz);
+
+            //reuse the template of the quantized sub-voxel offset, shifted
+            //to (tx,ty,tz), when all of it lies inside the volume and the
+            //mask. Elsewhere masking changes the kernel, so it is resampled
+            if (subdivisions > 0) {
+              int qx = max(0, min(subdivisions - 1,
+                    (int)floor((bx - tx + 0.5) * subdivisions)));
+              int qy = max(0, min(subdivisions - 1,
+                    (int)floor((by - ty + 0.5) * subdivisions)));
+              int qz = max(0, min(subdivisions - 1,
+                    (int)floor((bz - tz + 0.5) * subdivisions)));
+              int key = (qx * subdivisions + qy) * subdivisions + qz;
+              if (!built[key]) {
+                buildTemplate((qx + 0.5) / subdivisions - 0.5,
+                    (qy + 0.5) / subdivisions - 0.5,
+                    (qz + 0.5) / subdivisions - 0.5, templates[key]);
+                built[key] = true;
+              }
+
+              vector<PSFTAP>& kernel = templates[key];
+              bool fits = !kernel.empty();
+              for (auto& e : kernel) {
+                l = e.x + tx;
+                m = e.y + ty;
+                n = e.z + tz;
+                if ((l < 0) || (l >= volX) || (m < 0) || (m >= volY) ||
+                    (n < 0) || (n >= volZ) || (_mask(l, m, n) != 1)) {
+                  fits = false;
+                  break;
+                }
+              }
+
+              if (fits) {
+                for (auto& e : kernel) {
+                  p.index = _reconstructed.VoxelToIndex(e.x + tx, e.y + ty,
+                      e.z + tz);
+                  p.value = e.value;
+                  slicecoeffs[i][j].push_back(p);
+                }
+                sliceInside = true;
+                continue;
+              }
+            }
+
+            //Clear the transformed PSF
+            irtkRealPixel *tp = tPSF.GetPointerToVoxels();
+            for (ii = 0; ii < dim * dim * dim; ii++)
+              tp[ii] = 0;
+
+            //position of every PSF sample centered over current slice voxel,
+            //a single add per sample, free of branches so that it vectorizes
+            for (s = 0; s < nSamples; s++) {
+              double px = bx + ox[s];
+              double py = by + oy[s];
+              double pz = bz + oz[s];
+              double fx = floor(px);
+              double fy = floor(py);
+              double fz = floor(pz);
+              nxs[s] = (int)fx;
+              nys[s] = (int)fy;
+              nzs[s] = (int)fz;
+              fxs[s] = px - fx;
+              fys[s] = py - fy;
+              fzs[s] = pz - fz;
+            }
+
+            for (s = 0; s < nSamples; s++) {
+              nx = nxs[s];
+              ny = nys[s];
+              nz = nzs[s];
+
+              //trilinear weights of the 8 neighbours, zero for neighbours
+              //outside the volume. Not all neighbours might be in ROI, thus
+              //we need to normalize
+              double wx[2] = {1 - fxs[s], fxs[s]};
+              double wy[2] = {1 - fys[s], fys[s]};
+              double wz[2] = {1 - fzs[s], fzs[s]};
+              double w[8];
+              sum = 0;
+              //to find wether the current slice voxel has overlap with ROI
+              bool inside = false;
+              int q = 0;
+              for (l = 0; l < 2; l++)
+                for (m = 0; m < 2; m++)
+                  for (n = 0; n < 2; n++, q++) {
+                    w[q] = 0;
+                    if ((nx + l >= 0) && (nx + l < volX) && (ny + m >= 0) &&
+                        (ny + m < volY) && (nz + n >= 0) && (nz + n < volZ)) {
+                      w[q] = wx[l] * wy[m] * wz[n];
+                      sum += w[q];
+                      if (_mask(nx + l, ny + m, nz + n) == 1) {
+                        inside = true;
+                        sliceInside = true;
+                      }
+                    }
+                  }
+              //if there were no voxels do nothing
+              if ((sum <= 0) || (!inside))
+                continue;
+              //now calculate the transformed PSF
+              q = 0;
+              for (l = nx; l <= nx + 1; l++)
+                for (m = ny; m <= ny + 1; m++)
+                  for (n = nz; n <= nz + 1; n++, q++) {
+                    weight = w[q];
+                    if (weight == 0)
+                      continue;
+
+                    //image coordinates in tPSF
+                    //(centre,centre,centre) in tPSF is aligned with
+                    //(tx,ty,tz)
+                    int aa, bb, cc;
+                    aa = l - tx + centre;
+                    bb = m - ty + centre;
+                    cc = n - tz + centre;
+
+                    //resulting value
+                    double value = psf[s] * weight / sum;
+
+                    //Check that we are in tPSF
+                    if ((aa < 0) || (aa >= dim) || (bb < 0) 
+                        || (bb >= dim) || (cc < 0) || (cc >= dim)) {
+                      cerr << "Error while trying to populate tPSF. " 
+                        << aa << " " << bb
+                        << " " << cc << endl;
+                      cerr << l << " " << m << " " << n << endl;
+                      cerr << tx << " " << ty << " " << tz << endl;
+                      cerr << centre << endl;
+                      exit(1);
+                    }
+                    else
+                      //update transformed PSF
+                      tPSF(aa, bb, cc) += value;
+                  }
+            } 
+
+            //store tPSF values
+            for (ii = 0; ii < dim; ii++)
+              for (jj = 0; jj < dim; jj++)
+                for (kk = 0; kk < dim; kk++)
+                  if (tPSF(ii, jj, kk) > 0) {
+                    p.index = _reconstructed.VoxelToIndex(ii + tx - centre,
+                        jj + ty - centre, kk + tz - centre);
+                    p.value = tPSF(ii, jj, kk);
+                    slicecoeffs[i][j].push_back(p);
+                  }
+          } //end of loop for slice voxels
+
+      _volcoeffs[index] = slicecoeffs;
+      _sliceInsideCPU[index] = sliceInside;
+    }
+  });
+}
+
+/*
+ * Returns false for the messages of a streamed or resumed bootstrap, which
+ * are not answered
+ */
+bool irtkBackend::CoeffInit(ebbrt::IOBuf::DataPointer& dp, 
+    size_t cpu) {
+
+  int mode = dp.Get<int>();
+  bool coefficients = true;
+
+  switch (mode) {
+    case COEFF_INIT_BOOTSTRAP:
+      CoeffInitBootstrap(dp, cpu, false);
+      break;
+    case COEFF_INIT_STREAM_START:
+      CoeffInitBootstrap(dp, cpu, true);
+      return false;
+    case COEFF_INIT_RESUME:
+      // The coefficients follow with the CoeffInit of the resumed iteration
+      CoeffInitBootstrap(dp, cpu, false);
+      return false;
+    case COEFF_INIT_STREAM_SLICES:
+      CoeffInitSlices(dp);
+      return false;
+    case COEFF_INIT_STREAM_END:
+      {
+        // The streamed coefficients are kept if the PSF did not change
+        auto qualityFactor = _qualityFactor;
+        auto psfRadius = _psfRadius;
+        StoreCoeffInitParameters(dp);
+        InitializeEM();
+        _voxelNum.resize(_slices.size());
+        coefficients = (_qualityFactor != qualityFactor) ||
+          (_psfRadius != psfRadius);
+        break;
+      }
+    default:
+      StoreCoeffInitParameters(dp);
+  }
+  
+  InitializeEMValues();
+
+  if (coefficients) {
+    _volcoeffs.clear();
+    _volcoeffs.resize(_slices.size());
+
+    _sliceInsideCPU.clear();
+    _sliceInsideCPU.resize(_slices.size());
+
+    ParallelCoeffInit();
+  }
+
+  _volumeWeights.Initialize(_reconstructed.GetImageAttributes());
+  _volumeWeights = 0;
+
+  int i, j, n, k, inputIndex;
+  POINT3D p;
+  irtkRealPixel *pw = _volumeWeights.GetPointerToVoxels();
+  for (inputIndex = _start; inputIndex < (int) _end; ++inputIndex) {
+    for (i = 0; i < _slices[inputIndex].GetX(); i++) {
+      for (j = 0; j < _slices[inputIndex].GetY(); j++) {
+        n = _volcoeffs[inputIndex][i][j].size();
+        for (k = 0; k < n; k++) {
+          p = _volcoeffs[inputIndex][i][j][k];
+          pw[p.index] += p.value;
+        }
+      }
+    }
+  }
+
+  // find average volume weight to modify alpha parameters accordingly
+  irtkRealPixel *ptr = _volumeWeights.GetPointerToVoxels();
+  irtkRealPixel *pm = _mask.GetPointerToVoxels();
+  double sum = 0;
+  int num = 0;
+  for (int i = 0; i < _volumeWeights.GetNumberOfVoxels(); i++) {
+    if (*pm == 1) {
+      sum += *ptr;
+      num++;
+    }
+    ptr++;
+    pm++;
+  }
+  _averageVolumeWeight = sum / num;
+  return true;
+}
+/* End of CoeffInit functions */
+
+/*
+ * GaussianReconstruction functions
+ */
+void irtkBackend::GaussianReconstruction() {
+  int inputIndex;
+  int i, j, k, n;
+  irtkRealImage slice;
+  double scale;
+  POINT3D p;
+  int sliceVoxNum;
+
+  //clear _reconstructed image
+  _reconstructed = 0;
+  irtkRealPixel *pr = _reconstructed.GetPointerToVoxels();
+
+  for (inputIndex = _start; inputIndex < _end; ++inputIndex) {
+    slice = _slices[inputIndex];
+    irtkRealImage& b = _bias[inputIndex];
+    scale = _scaleCPU[inputIndex];
+    sliceVoxNum = 0;
+
+    //Distribute slice intensities to the volume
+    for (i = 0; i < slice.GetX(); i++) {
+      for (j = 0; j < slice.GetY(); j++) {
+        if (slice(i, j, 0) != -1) {
+          //biascorrect and scale the slice
+          slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+
+          //number of volume voxels with non-zero coefficients
+          //for current slice voxel
+          n = _volcoeffs[inputIndex][i][j].size();
+
+          //if given voxel is not present in reconstructed volume at all,
+          //pad it
+          if (n > 0)
+            sliceVoxNum++;
+
+          //add contribution of current slice voxel to all voxel volumes
+          //to which it contributes
+          for (k = 0; k < n; k++) {
+            p = _volcoeffs[inputIndex][i][j][k];
+            pr[p.index] += p.value * slice(i, j, 0);
+          }
+        }
+      }
+    }
+
+    _voxelNum[inputIndex] = sliceVoxNum;
+  }
+}
+
+void irtkBackend::ReturnFromGaussianReconstruction(
+    Messenger::NetworkId frontEndNid) {
+
+  cout << "In ReturnFromGaussianReconstruction() to send back to " << frontEndNid.ToString() << " from IO Core: " << _IOCPU << endl;
+
+  RunOnIOCPU(
+      [this,frontEndNid]() {
+ 
+      auto buf = MakeUniqueIOBuf(3 * sizeof(int));
+      auto dp = buf->GetMutDataPointer();
+
+      dp.Get<int>() = GAUSSIAN_RECONSTRUCTION;
+      dp.Get<int>() = _start;
+      dp.Get<int>() = _end;
+
+      auto vnum = std::make_unique<StaticIOBuf>(
+        reinterpret_cast<const uint8_t *>(_voxelNum.data() + _start),
+        (size_t)((_end-_start) * sizeof(int)));
+
+      buf->PrependChain(std::move(vnum));
+      buf->PrependChain(std::move(serializeSlice(_reconstructed)));
+      buf->PrependChain(std::move(serializeSlice(_volumeWeights)));
+
+      _phase_performance[GAUSSIAN_RECONSTRUCTION].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+
+}
+/* End of GaussianReconstruction functions */
+
+/*
+ * SimulateSlices functions
+ */
+void irtkBackend::ParallelSimulateSlices() {
+
+  ParallelFor(SIMULATE_SLICES, [this](int start, int end) {
+    for (int inputIndex = start; inputIndex < end; ++inputIndex) {
+      _simulatedSlices[inputIndex].Initialize(
+          _slices[inputIndex].GetImageAttributes());
+
+      _simulatedSlices[inputIndex] = 0;
+
+      _simulatedWeights[inputIndex].Initialize(
+          _slices[inputIndex].GetImageAttributes());
+
+      _simulatedWeights[inputIndex] = 0;
+
+      _simulatedInside[inputIndex].Initialize(
+          _slices[inputIndex].GetImageAttributes());
+
+      _simulatedInside[inputIndex] = 0;
+      _sliceInsideCPU[inputIndex] = 0;
+
+      POINT3D p;
+      irtkRealPixel *pr = _reconstructed.GetPointerToVoxels();
+      irtkRealPixel *pm = _mask.GetPointerToVoxels();
+      for (unsigned int i = 0; (int) i < _slices[inputIndex].GetX();
+          i++) {
+        for (unsigned int j = 0; (int) j < _slices[inputIndex].GetY();
+            j++) {
+          if (_slices[inputIndex](i, j, 0) != -1) {
+            double weight = 0;
+            int n = _volcoeffs[inputIndex][i][j].size();
+
+            for (unsigned int k = 0; (int) k < n; k++) {
+              p = _volcoeffs[inputIndex][i][j][k];
+
+              _simulatedSlices[inputIndex](i, j, 0) +=
+                p.value * pr[p.index];
+              weight += p.value;
+
+              if (pm[p.index] == 1) {
+                _simulatedInside[inputIndex](i, j, 0) = 1;
+                _sliceInsideCPU[inputIndex] = 1;
+              }
+            }
+
+            if (weight > 0) {
+              _simulatedSlices[inputIndex](i, j, 0) /= weight;
+              _simulatedWeights[inputIndex](i, j, 0) = weight;
+            }
+          }
+        }
+      }
+    }
+  });
+}
+
+int irtkBackend::SimulateSlices(ebbrt::IOBuf::DataPointer& dp) {
+
+  int initialize = dp.Get<int>();
+
+  if (initialize) {
+    _simulatedSlices.clear();
+    _simulatedSlices.resize(_slices.size());
+
+    _simulatedWeights.clear();
+    _simulatedWeights.resize(_slices.size());
+
+    _simulatedInside.clear();
+    _simulatedInside.resize(_slices.size());
+
+    for(int i= _start ; i < _end; i++) {
+      _simulatedSlices[i] = _slices[i];
+      _simulatedWeights[i] = _slices[i];
+      _simulatedInside[i] = _slices[i];
+    }
+  }
+
+  int reconSize = dp.Get<int>();
+  dp.Get(reconSize*sizeof(double), (uint8_t*)_reconstructed.GetMat());
+
+  ParallelSimulateSlices();
+
+  return initialize;
+}
+/* End of SimulateSlices functions */
+
+/*
+ * InitializeRobustStatistics functions
+ */
+
+void irtkBackend::InitializeRobustStatistics(double& sigma, int& num) {
+  int i, j;
+  irtkRealImage slice, sim;
+  sigma = 0.0;
+  num = 0;
+
+  for (unsigned int inputIndex = _start; inputIndex < _end; inputIndex++) {
+    slice = _slices[inputIndex];
+
+    // [fetalRecontruction] Voxel-wise sigma will be set to stdev of volumetric 
+    // [fetalRecontruction] errors
+    for (i = 0; i < slice.GetX(); i++)
+      for (j = 0; j < slice.GetY(); j++)
+        if (slice(i, j, 0) != -1) {
+          // [fetalRecontruction] calculate stev of the errors
+          if ((_simulatedInside[inputIndex](i, j, 0) == 1) &&
+              (_simulatedWeights[inputIndex](i, j, 0) > 0.99)) {
+            slice(i, j, 0) -= _simulatedSlices[inputIndex](i, j, 0);
+            sigma += slice(i, j, 0) * slice(i, j, 0);
+            num++;
+          }
+        }
+
+    // [fetalRecontruction] if slice does not have an overlap with ROI, 
+    // [fetalRecontruction] set its weight to zero
+    if (!_sliceInsideCPU[inputIndex])
+      _sliceWeightCPU[inputIndex] = 0;
+  }
+
+}
+
+void irtkBackend::ReturnFromInitializeRobustStatistics(double& sigma, 
+    int& num, Messenger::NetworkId frontEndNid) {
+  RunOnIOCPU(
+      [this,frontEndNid, sigma, num]() {
+      auto buf = MakeUniqueIOBuf((2 * sizeof(int)) + (1 * sizeof(double)));
+      auto dp = buf->GetMutDataPointer();
+
+      dp.Get<int>() = INITIALIZE_ROBUST_STATISTICS;
+      dp.Get<int>() = num;
+      dp.Get<double>() = sigma;
+
+      _phase_performance[INITIALIZE_ROBUST_STATISTICS].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+/* End of RobustStatistics functions */
+
+/*
+ * EStep functions
+ */
+double irtkBackend::M(double m) {
+  return m*_step;
+}
+
+double irtkBackend::G(double x, double s) {
+  return _step*exp(-x*x / (2 * s)) / (sqrt(6.28*s));
+}
+
+void irtkBackend::ParallelEStep(
+    struct eStepReturnParameters& parameters) {
+
+  ParallelFor(E_STEP_I, [this, &parameters](int start, int end) {
+    double sum = 0;
+    double den = 0;
+    double sum2 = 0;
+    double den2 = 0;
+    double maxs = 0;
+    double mins = 1;
+
+    for (int inputIndex = start; inputIndex < end; inputIndex++) {
+      irtkRealImage slice = _slices[inputIndex];
+      _weights[inputIndex] = 0;
+      irtkRealImage &b = _bias[inputIndex];
+      double scale = _scaleCPU[inputIndex];
+
+      double num = 0;
+      // [fetalRecontruction] Calculate error, voxel weights, and slice potential
+      for (int i = 0; i < slice.GetX(); i++) {
+        for (int j = 0; j < slice.GetY(); j++) {
+          if (slice(i, j, 0) != -1) {
+            // [fetalRecontruction] bias correct and scale the slice
+            slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+
+            // [fetalRecontruction] number of volumetric voxels to which
+            // [fetalRecontruction] current slice voxel contributes
+            int n = _volcoeffs[inputIndex][i][j].size();
+
+            // [fetalRecontruction] if n == 0, slice voxel has no overlap with 
+            // [fetalRecontruction] volumetric ROI, do not process it
+
+            if ((n > 0) &&
+                (_simulatedWeights[inputIndex](i, j, 0) > 0)) {
+              slice(i, j, 0) -=
+                _simulatedSlices[inputIndex](i, j, 0);
+
+              // [fetalRecontruction] calculate norm and voxel-wise weights
+              // [fetalRecontruction] Gaussian distribution for inliers
+              // (likelihood)
+              double g = G(slice(i, j, 0), _sigmaCPU);
+              // [fetalRecontruction] Uniform distribution for outliers
+              // (likelihood)
+              double m = M(_mCPU);
+
+              // [fetalRecontruction] voxel_wise posterior
+              double weight = g * _mixCPU / (g * _mixCPU + m * (1 - _mixCPU));
+              _weights[inputIndex](i, j, 0) = weight;
+              // [fetalRecontruction] calculate slice potentials
+              if (_simulatedWeights[inputIndex](i, j, 0) > 0.99) {
+                _slicePotential[inputIndex] += (1.0 - weight) * (1.0 - weight);
+                num++;
+              }
+            } else {
+              _weights[inputIndex](i, j, 0) = 0;
+            }
+          }
+        }
+      }
+
+      // [fetalRecontruction] evaluate slice potential
+      if (num > 0) {
+        _slicePotential[inputIndex] = sqrt(_slicePotential[inputIndex] / num);
+      } else {
+        // [fetalRecontruction] slice has no unpadded voxels
+        _slicePotential[inputIndex] = -1; 
+      }
+
+      //TODO: Force excluded has to be received in the CoeffInit Step
+      //To force-exclude slices predefined by a user, set their potentials to -1
+      //for (unsigned int i = 0; i < _force_excluded.size(); i++)
+      //  _slicePotential[_force_excluded[i]] = -1;
+
+      for(int i = 0; i < _smallSlices.size(); i++) {
+        _slicePotential[_smallSlices[i]] = -1;
+      }
+
+      if ((_scaleCPU[inputIndex] < 0.2) || (_scaleCPU[inputIndex] > 5)) {
+        _slicePotential[inputIndex] = -1;
+      }
+
+      if (_slicePotential[inputIndex] >= 0) {
+        // calculate means
+        sum += _slicePotential[inputIndex] * _sliceWeightCPU[inputIndex];
+        den += _sliceWeightCPU[inputIndex];
+        sum2 += _slicePotential[inputIndex] * 
+          (1 - _sliceWeightCPU[inputIndex]);
+        den2 += (1 - _sliceWeightCPU[inputIndex]);
+
+        // calculate min and max of potentials in case means need to be initalized
+        if (_slicePotential[inputIndex] > maxs)
+          maxs = _slicePotential[inputIndex];
+        if (_slicePotential[inputIndex] < mins)
+          mins = _slicePotential[inputIndex];
+      } 
+    }
+
+    {
+      std::lock_guard<ebbrt::SpinLock> l(spinLock);
+      parameters.sum += sum;
+      parameters.den += den;
+      parameters.sum2 += sum2;
+      parameters.den2 += den2;
+      if (mins < parameters.mins)
+        parameters.mins = mins;
+      if (maxs > parameters.maxs)
+        parameters.maxs = maxs;
+    
+    }
+  });
+}
+
+void irtkBackend::StoreEStepParameters(
+    ebbrt::IOBuf::DataPointer& dp) {
+  auto parameters = dp.Get<struct eStepParameters>();
+  _mCPU = parameters.mCPU;
+  _sigmaCPU = parameters.sigmaCPU;
+  _mixCPU = parameters.mixCPU;
+
+  int smallSlicesSize = dp.Get<int>();
+  _smallSlices.resize(smallSlicesSize);
+  dp.Get(smallSlicesSize*sizeof(int), (uint8_t*) _smallSlices.data());
+}
+
+struct eStepReturnParameters irtkBackend::EStepI(
+    ebbrt::IOBuf::DataPointer& dp) {
+  StoreEStepParameters(dp);
+  struct eStepReturnParameters parameters;
+  parameters.sum = 0;
+  parameters.den = 0;
+  parameters.sum2 = 0;
+  parameters.den2 = 0;
+  parameters.maxs = 0;
+  parameters.mins = 1;
+
+  for (int i = 0; i < _slicePotential.size(); i++)
+    _slicePotential[i] = 0;
+  
+  ParallelEStep(parameters);
+  return parameters;
+}
+
+struct eStepReturnParameters irtkBackend::EStepII(
+    ebbrt::IOBuf::DataPointer& dp) {
+
+  auto parameters = dp.Get<struct eStepParameters>();
+  double meanSCPU = parameters.meanSCPU;
+  double meanS2CPU = parameters.meanS2CPU;
+  
+  struct eStepReturnParameters returnParameters;
+  returnParameters.sum = 0;
+  returnParameters.den = 0;
+  returnParameters.sum2 = 0;
+  returnParameters.den2 = 0;
+
+  for (int inputIndex = _start; inputIndex < _end; inputIndex++) {
+    if (_slicePotential[inputIndex] >= 0) {
+      returnParameters.sum += (_slicePotential[inputIndex] - meanSCPU) *
+        (_slicePotential[inputIndex] - meanSCPU) *
+        _sliceWeightCPU[inputIndex];
+
+      returnParameters.den += _sliceWeightCPU[inputIndex];
+
+      returnParameters.sum2 += (_slicePotential[inputIndex] - meanS2CPU) *
+        (_slicePotential[inputIndex] - meanS2CPU) *
+        (1 - _sliceWeightCPU[inputIndex]);
+
+      returnParameters.den2 += (1 - _sliceWeightCPU[inputIndex]);
+    }
+  }
+
+  return returnParameters;
+}
+
+struct eStepReturnParameters irtkBackend::EStepIII(
+    ebbrt::IOBuf::DataPointer& dp) {
+  auto parameters = dp.Get<struct eStepParameters>();
+  double sigmaSCPU = parameters.sigmaSCPU;
+  double sigmaS2CPU = parameters.sigmaS2CPU;
+  double meanSCPU = parameters.meanSCPU;
+  double meanS2CPU = parameters.meanS2CPU;
+  double den = parameters.den;
+  double mixSCPU = parameters.mixSCPU;
+
+  if (_debug) {
+    cout << "[EStepIII input] _meanSCPU: " << meanSCPU << endl; 
+    cout << "[EStepIII input] _meanS2CPU: " << meanS2CPU << endl; 
+    cout << "[EStepIII input] _mixSCPU: " << mixSCPU << endl; 
+    cout << "[EStepIII input] _sigmaSCPU: " << sigmaSCPU << endl; 
+    cout << "[EStepIII input] _sigmaS2CPU: " << sigmaS2CPU << endl; 
+    cout << "[EStepIII input] _den: " << den << endl; 
+    PrintImageSums("[EStepIII input]");
+  }
+
+  struct eStepReturnParameters returnParameters;
+  returnParameters.sum = 0;
+  returnParameters.num = 0;
+
+  double gs1, gs2;
+
+  for (int inputIndex = _start; inputIndex < _end; inputIndex++) {
+    // [fetalReconstruction] Slice does not have any voxels in volumetric ROI
+    if (_slicePotential[inputIndex] == -1) {
+      _sliceWeightCPU[inputIndex] = 0;
+      continue;
+    }
+
+    // [fetalReconstruction] All slices are outliers or the means are not valid
+    if ((den <= 0) || (meanS2CPU <= meanSCPU)) {
+      _sliceWeightCPU[inputIndex] = 1;
+      continue;
+    }
+
+    // [fetalReconstruction] likelihood for inliers
+    if (_slicePotential[inputIndex] < meanS2CPU)
+      gs1 = G(_slicePotential[inputIndex] - meanSCPU, sigmaSCPU);
+    else
+      gs1 = 0;
+
+    // [fetalReconstruction] likelihood for outliers
+    if (_slicePotential[inputIndex] > meanSCPU)
+      gs2 = G(_slicePotential[inputIndex] - meanS2CPU, sigmaS2CPU);
+    else
+      gs2 = 0;
+
+    // [fetalReconstruction] calculate slice weight
+    double likelihood = gs1 * mixSCPU + gs2 * (1 - mixSCPU);
+    if (likelihood > 0)
+      _sliceWeightCPU[inputIndex] = gs1 * mixSCPU / likelihood;
+    else {
+      if (_slicePotential[inputIndex] <= meanSCPU)
+        _sliceWeightCPU[inputIndex] = 1;
+      if (_slicePotential[inputIndex] >= meanS2CPU)
+        _sliceWeightCPU[inputIndex] = 0;
+      if ((_slicePotential[inputIndex] < meanS2CPU) &&
+          (_slicePotential[inputIndex] > meanSCPU)) // should not happen
+        _sliceWeightCPU[inputIndex] = 1;
+    }
+
+    if (_slicePotential[inputIndex] >= 0) {
+      returnParameters.sum += _sliceWeightCPU[inputIndex];
+      returnParameters.num ++;
+    }
+  }
+  return returnParameters;
+}
+
+void irtkBackend::ReturnFromEStepI(
+    struct eStepReturnParameters parameters, Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+      [this,frontEndNid, parameters]() {
+      auto buf = MakeUniqueIOBuf(sizeof(int) + sizeof(eStepReturnParameters));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = E_STEP_I;
+      dp.Get<struct eStepReturnParameters>() = parameters;
+
+      _phase_performance[E_STEP_I].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+
+void irtkBackend::ReturnFromEStepII(
+    struct eStepReturnParameters parameters, Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+      [this,frontEndNid, parameters]() {
+      auto buf = MakeUniqueIOBuf(sizeof(int) + sizeof(eStepReturnParameters));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = E_STEP_II;
+      dp.Get<struct eStepReturnParameters>() = parameters;
+
+      _phase_performance[E_STEP_II].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+
+void irtkBackend::ReturnFromEStepIII(
+    struct eStepReturnParameters parameters, Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+      [this,frontEndNid, parameters]() {
+      auto buf = MakeUniqueIOBuf(3 * sizeof(int) +
+          sizeof(eStepReturnParameters));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = E_STEP_III;
+      dp.Get<struct eStepReturnParameters>() = parameters;
+      dp.Get<int>() = _start;
+      dp.Get<int>() = _end;
+
+      // The front-end only reports the slice weights
+      auto weights = std::make_unique<StaticIOBuf>(
+        reinterpret_cast<const uint8_t *>(_sliceWeightCPU.data() + _start),
+        (size_t)((_end - _start) * sizeof(double)));
+      buf->PrependChain(std::move(weights));
+
+      _phase_performance[E_STEP_III].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+/* End of EStep functions */
+
+/* 
+ * Scale functions 
+ */
+void irtkBackend::ParallelScale() {
+
+  ParallelFor(SCALE, [this](int start, int end) {
+    for (int inputIndex = start; inputIndex < end; inputIndex++) {
+      // [fetalRecontruction] alias the current slice
+      irtkRealImage &slice = _slices[inputIndex];
+
+      // [fetalRecontruction] alias the current weight image
+      irtkRealImage &w = _weights[inputIndex];
+
+      // [fetalRecontruction] alias the current bias image
+      irtkRealImage &b = _bias[inputIndex];
+
+      // [fetalRecontruction] initialise calculation of scale
+      double scalenum = 0;
+      double scaleden = 0;
+
+      for (int i = 0; i < slice.GetX(); i++)
+        for (int j = 0; j < slice.GetY(); j++)
+          if (slice(i, j, 0) != -1) {
+            if (_simulatedWeights[inputIndex](i, j, 0) > 0.99) {
+              // [fetalRecontruction] scale - intensity matching
+              double eb = exp(-b(i, j, 0));
+              scalenum += w(i, j, 0) * slice(i, j, 0) * eb *
+                _simulatedSlices[inputIndex](i, j, 0);
+              scaleden += w(i, j, 0) * slice(i, j, 0) * eb * slice(i, j, 0) * eb;
+            }
+          }
+
+      // [fetalRecontruction] calculate scale for this slice
+      if (scaleden > 0)
+        _scaleCPU[inputIndex] = scalenum / scaleden;
+      else
+        _scaleCPU[inputIndex] = 1;
+    }
+  });
+}
+
+void irtkBackend::Scale() {
+  ParallelScale();
+}
+
+/* End of Scale functions */
+
+/*
+ * Superresolution functions
+ */
+
+void irtkBackend::ParallelSuperresolution() {
+  
+  ParallelFor(SUPERRESOLUTION, [this](int start, int end) {
+    irtkRealImage addon;
+    irtkRealImage confidenceMap;
+
+    addon.Initialize(_reconstructed.GetImageAttributes());
+    confidenceMap.Initialize(_reconstructed.GetImageAttributes());
+
+    addon = 0;
+    confidenceMap = 0;
+    irtkRealPixel *pa = addon.GetPointerToVoxels();
+    irtkRealPixel *pc = confidenceMap.GetPointerToVoxels();
+
+    for (int inputIndex = start; inputIndex < end; ++inputIndex) {
+      // [fetalReconstruction] read the current slice
+      irtkRealImage slice = _slices[inputIndex];
+
+      // [fetalReconstruction] read the current weight image
+      irtkRealImage &w = _weights[inputIndex];
+
+      // [fetalReconstruction] read the current bias image
+      irtkRealImage &b = _bias[inputIndex];
+
+      // [fetalReconstruction] identify scale factor
+      double scale = _scaleCPU[inputIndex];
+
+      // [fetalReconstruction] Update reconstructed volume using current slice
+      // [fetalReconstruction] Distribute error to the volume
+      POINT3D p;
+      for (int i = 0; i < slice.GetX(); i++) {
+        for (int j = 0; j < slice.GetY(); j++) {
+          if (slice(i, j, 0) != -1) {
+            // [fetalReconstruction] bias correct and scale the slice
+            slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+
+            if (_simulatedSlices[inputIndex](i, j, 0) > 0)
+              slice(i, j, 0) -= _simulatedSlices[inputIndex](i, j, 0);
+            else
+              slice(i, j, 0) = 0;
+
+            int n = _volcoeffs[inputIndex][i][j].size();
+            for (int k = 0; k < n; k++) {
+              p = _volcoeffs[inputIndex][i][j][k];
+              pa[p.index] += p.value * slice(i, j, 0) * w(i, j, 0) *
+                _sliceWeightCPU[inputIndex];
+              pc[p.index] += p.value * w(i, j, 0) *
+                _sliceWeightCPU[inputIndex];
+            }
+          }
+        }
+      }
+    }
+    
+    {
+      std::lock_guard<ebbrt::SpinLock> l(spinLock);
+      _addon += addon;
+      _confidenceMap += confidenceMap;
+    }
+  });
+}
+
+void irtkBackend::SuperResolution(ebbrt::IOBuf::DataPointer& dp) {
+
+  int iter = dp.Get<int>();
+  
+  if(iter == 1) {
+      _addon.Initialize(_reconstructed.GetImageAttributes());
+      _confidenceMap.Initialize(_reconstructed.GetImageAttributes());
+  } 
+  // Clear addon
+  _addon = 0;
+
+  // Clear confidence map
+  _confidenceMap = 0;
+  
+  ParallelSuperresolution();
+
+}
+
+void irtkBackend::ReturnFromSuperResolution(
+    Messenger::NetworkId frontEndNid) {
+  RunOnIOCPU(
+      [this,frontEndNid]() {
+      auto buf = MakeUniqueIOBuf(sizeof(int));
+      auto dp = buf->GetMutDataPointer();
+  
+      dp.Get<int>() = SUPERRESOLUTION;
+  
+      buf->PrependChain(std::move(serializeSlice(_addon)));
+      buf->PrependChain(std::move(serializeSlice(_confidenceMap)));
+
+      _phase_performance[SUPERRESOLUTION].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+
+/* End of Superresolution */
+
+/*
+ * MStep functions
+ */
+void irtkBackend::ParallelMStep(mStepReturnParameters& parameters) {
+  
+  ParallelFor(M_STEP, [this, &parameters](int start, int end) {
+    double sigma = 0;
+    double mix = 0;
+    double min = 0;
+    double max = 0;
+    int num = 0;
+  
+    for (int inputIndex = start; inputIndex < end; ++inputIndex) {
+
+      irtkRealImage slice = _slices[inputIndex];
+
+      irtkRealImage &w = _weights[inputIndex];
+
+      irtkRealImage &b = _bias[inputIndex];
+
+      // [fetalReconstruction] identify scale factor
+      double scale = _scaleCPU[inputIndex];
+
+      // [fetalReconstruction] calculate error
+      for (int i = 0; i < slice.GetX(); i++) {
+        for (int j = 0; j < slice.GetY(); j++) {
+          if (slice(i, j, 0) != -1) {
+            // [fetalReconstruction] bias correct and scale the slice
+            slice(i, j, 0) *= exp(-b(i, j, 0)) * scale;
+
+            // [fetalReconstruction] otherwise the error has no meaning - 
+            // [fetalReconstruction] it is equal to slice intensity
+            if (_simulatedWeights[inputIndex](i, j, 0) > 0.99) {
+
+              slice(i, j, 0) -= _simulatedSlices[inputIndex](i, j, 0);
+
+              double e = slice(i, j, 0);
+              sigma += e * e * w(i, j, 0);
+              mix += w(i, j, 0);
+
+              if (e < min)
+                min = e;
+              if (e > max)
+                max = e;
+
+              num++;
+            }
+          }
+        }
+      }
+    } 
+
+    {
+      
+      std::lock_guard<ebbrt::SpinLock> l(spinLock);
+      parameters.sigma += sigma;
+      parameters.mix += mix;
+      parameters.num += num;
+      if (min < parameters.min)
+        parameters.min = min;
+      if (max > parameters.max)
+        parameters.max = max;
+    }
+  });
+}
+
+void irtkBackend::MStep(mStepReturnParameters& parameters) {
+  parameters.sigma = 0;
+  parameters.mix = 0;
+  parameters.num = 0;
+  parameters.min = voxel_limits<irtkRealPixel>::max();
+  parameters.max = voxel_limits<irtkRealPixel>::min();
+
+  ParallelMStep(parameters);
+}
+
+void irtkBackend::ReturnFromMStep(mStepReturnParameters& parameters,
+    Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+      [this,frontEndNid, parameters]() {
+      auto buf = MakeUniqueIOBuf(sizeof(int) + sizeof(mStepReturnParameters));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = M_STEP;
+      dp.Get<mStepReturnParameters>() = parameters;
+      _phase_performance[M_STEP].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+/* End of MStep*/
+
+/*
+ * RestoreSliceIntensities functions
+ */
+
+void irtkBackend::RestoreSliceIntensities() {
+  double factor;
+  irtkRealPixel *p;
+  for (int inputIndex = _start; inputIndex < _end; inputIndex++) {
+      // [fetalRecontruction] calculate scaling factor 
+      // [fetalRecontruction] _average_value;
+      factor = _stackFactor[_stackIndex[inputIndex]];
+      // [fetalRecontruction] read the pointer to current slice
+      p = _slices[inputIndex].GetPointerToVoxels();
+      for (int i = 0; i < _slices[inputIndex].GetNumberOfVoxels(); i++) {
+        if (*p > 0)
+          *p = *p / factor;
+        p++;
+      }
+  }
+}
+
+/* End of RestoreSliceIntensities*/
+
+/*
+ * ScaleVolume functions
+ */
+
+struct scaleVolumeParameters irtkBackend::ScaleVolume() {
+  scaleVolumeParameters parameters;
+  parameters.num = 0;
+  parameters.den = 0;
+
+  for (int inputIndex = _start; inputIndex < _end; inputIndex++) {
+    irtkRealImage &slice = _slices[inputIndex];
+    irtkRealImage &w = _weights[inputIndex];
+    irtkRealImage &sim = _simulatedSlices[inputIndex];
+
+    for (int i = 0; i < slice.GetX(); i++) {
+      for (int j = 0; j < slice.GetY(); j++) {
+        if (slice(i, j, 0) != -1) {
+          // [fetalRecontruction] scale - intensity matching
+          if (_simulatedWeights[inputIndex](i, j, 0) > 0.99) {
+            parameters.num += w(i, j, 0) * _sliceWeightCPU[inputIndex] *
+              slice(i, j, 0) * sim(i, j, 0);
+            parameters.den += w(i, j, 0) * _sliceWeightCPU[inputIndex] *
+              sim(i, j, 0) * sim(i, j, 0);
+          }
+        }
+      }
+    }
+  } 
+  return parameters;
+}
+
+void irtkBackend::ReturnFromScaleVolume(
+    struct scaleVolumeParameters parameters, Messenger::NetworkId frontEndNid) {
+  
+  RunOnIOCPU(
+      [this,frontEndNid, parameters]() {
+      auto buf = MakeUniqueIOBuf(sizeof(int) + sizeof(scaleVolumeParameters));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = SCALE_VOLUME;
+      dp.Get<scaleVolumeParameters>() = parameters;
+      _phase_performance[SCALE_VOLUME].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+
+}
+/* End of ScaleVolume */
+
+/*
+ * SliceToVolumeRegistration functions
+ */
+
+void irtkBackend::ParallelSliceToVolumeRegistration() {
+  irtkImageAttributes attr = _reconstructed.GetImageAttributes();
+  
+  ParallelFor(SLICE_TO_VOLUME_REGISTRATION,
+      [this, attr](int start, int end) {
+    for (int inputIndex = start; inputIndex < end; inputIndex++) {
+      irtkImageRigidRegistrationWithPadding registration;
+      irtkGreyPixel smin, smax;
+      irtkGreyImage target;
+      irtkRealImage slice, w, b, t;
+      irtkResamplingWithPadding<irtkRealPixel> resampling(attr._dx, attr._dx,
+                                                          attr._dx, -1);
+
+      t = _slices[inputIndex];
+      resampling.SetInput(&_slices[inputIndex]);
+      resampling.SetOutput(&t);
+      resampling.Run();
+      target = t;
+      target.GetMinMax(&smin, &smax);
+
+      if (smax > -1) {
+        // [fetalRecontruction] put origin to zero
+        irtkRigidTransformation offset;
+        ResetOrigin(target, offset);
+        irtkMatrix mo = offset.GetMatrix();
+        irtkMatrix m = _transformations[inputIndex].GetMatrix();
+        m = m * mo;
+        _transformations[inputIndex].PutMatrix(m);
+
+        irtkGreyImage source = _reconstructed;
+        registration.SetInput(&target, &source);
+        
+        registration.SetOutput(&_transformations[inputIndex]);
+        registration.GuessParameterSliceToVolume();
+        registration.SetTargetPadding(-1);
+        
+        /*
+           if (_debug) {
+             cout << "[ParallelSliceToVolumeRegistration input] " << inputIndex
+             << " transformation: ";
+             _transformations[inputIndex].Print2();
+             cout << endl;
+             }
+        */
+
+        registration.Run();
+        
+        /*
+           if (_debug) {
+             cout << "[ParallelSliceToVolumeRegistration output] " << inputIndex 
+             << " transformation: ";
+             _transformations[inputIndex].Print2();
+             cout << endl;
+             }
+        */
+        
+        // [fetalRecontruction] undo the offset
+        mo.Invert();
+        m = _transformations[inputIndex].GetMatrix();
+        m = m * mo;
+        _transformations[inputIndex].PutMatrix(m);
+        
+      }
+    }
+  });
+}
+
+void irtkBackend::SliceToVolumeRegistration(
+    ebbrt::IOBuf::DataPointer& dp) {
+  
+  // The front-end moved the volume to another grid (coarse-to-fine)
+  int resized = dp.Get<int>();
+  if (resized) {
+    deserializeSlice(dp, _reconstructed);
+    deserializeSlice(dp, _mask);
+  } else {
+    int reconSize = dp.Get<int>();
+    dp.Get(reconSize*sizeof(double), (uint8_t*)_reconstructed.GetMat());
+  }
+
+  ParallelSliceToVolumeRegistration();
+}
+
+void irtkBackend::ReturnFromSliceToVolumeRegistration(
+    Messenger::NetworkId frontEndNid) {
+  
+  RunOnIOCPU(
+      [this,frontEndNid]() {
+      auto buf = MakeUniqueIOBuf(3*sizeof(int));
+      auto dp = buf->GetMutDataPointer();
+      dp.Get<int>() = SLICE_TO_VOLUME_REGISTRATION;
+      dp.Get<int>() = _start;
+      dp.Get<int>() = _end;
+	
+      buf->PrependChain(std::move(serializeTransformations(_start, _end,
+              _transformations)));
+
+      _phase_performance[SLICE_TO_VOLUME_REGISTRATION].sent += buf->ComputeChainDataLength();
+      SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+/* End of SliceToVolumeRegistration */
+
+/*
+ * Rebalance functions
+ */
+
+void irtkBackend::Rebalance(ebbrt::IOBuf::DataPointer& dp) {
+  int start = dp.Get<int>();
+  int end = dp.Get<int>();
+
+  // The new range may overlap the current one, only the missing slices are
+  // sent by the front-end. Their weights and bias only need the geometry of
+  // the slice, InitializeEMValues() sets them on the next CoeffInit.
+  int nIncoming = dp.Get<int>();
+  for (int k = 0; k < nIncoming; k++) {
+    int index = dp.Get<int>();
+    deserializeSlice(dp, _slices[index]);
+    _weights[index] = _slices[index];
+    _bias[index] = _slices[index];
+  }
+
+  auto nRigidTrans = dp.Get<int>();
+  for (int i = start; i < end; i++) {
+    deserializeTransformations(dp, _transformations[i]);
+  }
+
+  // Release the slices that were migrated to other nodes
+  for (int i = _start; i < _end; i++) {
+    if ((i >= start) && (i < end))
+      continue;
+    _slices[i] = irtkRealImage();
+    _weights[i] = irtkRealImage();
+    _bias[i] = irtkRealImage();
+    _simulatedSlices[i] = irtkRealImage();
+    _simulatedWeights[i] = irtkRealImage();
+    _simulatedInside[i] = irtkRealImage();
+  }
+
+  if (_debug) {
+    cout << "[Rebalance input] old range: [" << _start << ", " << _end << ")"
+      << endl;
+    cout << "[Rebalance input] new range: [" << start << ", " << end << ")"
+      << endl;
+  }
+
+  SetSliceRange(start, end);
+}
+/* End of Rebalance */
+
+void irtkBackend::ReturnFrom(int fn, Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+        [this,frontEndNid, fn]() {
+        auto buf = MakeUniqueIOBuf(sizeof(int));
+        auto dp = buf->GetMutDataPointer();
+        dp.Get<int>() = fn;
+        if (fn < WORK_PHASES)
+          _phase_performance[fn].sent += sizeof(int); 
+        SendToFrontEnd(frontEndNid, std::move(buf));
+  });
+}
+
+void irtkBackend::SendTimers(Messenger::NetworkId frontEndNid) {
+
+  RunOnIOCPU(
+      [this, frontEndNid]() {
+        // Only the events recorded since the previous request
+        vector<struct trace_event> trace;
+        {
+          std::lock_guard<std::mutex> l(_traceMutex);
+          trace.swap(_trace);
+        }
+
+        // The current time lets the front-end estimate the clock offset
+        auto buf = MakeUniqueIOBuf(sizeof(int) + sizeof(phases_data) +
+            sizeof(uint32_t) +
+            _worker_performance.size() * sizeof(worker_phases_data) +
+            sizeof(messages_data) + sizeof(counters_data) +
+            sizeof(uint64_t) + sizeof(uint32_t) +
+            trace.size() * sizeof(struct trace_event));
+        auto dp = buf->GetMutDataPointer();
+        dp.Get<int>() = GATHER_TIMERS;
+        dp.Get<phases_data>() = _phase_performance;
+        dp.Get<uint32_t>() = _worker_performance.size();
+        for (auto& worker : _worker_performance)
+          dp.Get<worker_phases_data>() = worker;
+        dp.Get<messages_data>() = _messages;
+        dp.Get<counters_data>() = _counters;
+        dp.Get<uint64_t>() = TimerNow();
+        dp.Get<uint32_t>() = trace.size();
+        for (auto& event : trace)
+          dp.Get<struct trace_event>() = event;
+        SendToFrontEnd(frontEndNid, std::move(buf));
+      });
+}
+
+bool irtkBackend::ExecuteCoeffInit(ebbrt::IOBuf::DataPointer& dp, 
+    size_t cpu) {
+
+  auto start = startTimer();
+  auto complete = CoeffInit(dp, cpu);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[COEFF_INIT].time += stop - start; 
+  // A streamed pass spans several messages, count the one that completes it
+  if (complete)
+    _phase_performance[COEFF_INIT].calls++;
+  Trace(TRACE_PHASE, COEFF_INIT, 0, 0, start, stop);
+
+  if (_debug && complete) {
+    cout << "[CoeffInit output] _averageVolumeWeight: " 
+      << _averageVolumeWeight << endl;
+    PrintImageSums("[CoeffInit output]");
+    cout << "[CoeffInit time] " << seconds << endl;
+  }
+
+  return complete;
+}
+
+void irtkBackend::ExecuteGaussianReconstruction(
+    Messenger::NetworkId frontEndNid) {
+
+
+  cout << "In ExecuteGaussianReconstruction() with frontEnd network " << frontEndNid.ToString() << endl;
+
+  auto start = startTimer();
+  GaussianReconstruction();
+  ReturnFromGaussianReconstruction(frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].time += stop - start; 
+  _phase_performance[GAUSSIAN_RECONSTRUCTION].calls++;
+  Trace(TRACE_PHASE, GAUSSIAN_RECONSTRUCTION, 0, 0, start, stop);
+
+  if (_debug) {
+    PrintImageSums("[GaussianReconstruction output]");
+    cout << fixed << "[GaussianReconstruction output] _volumeWeights: " 
+      << SumImage(_volumeWeights) << endl;
+    cout << "[GaussianReconstruction time] " << seconds << endl; 
+  }
+}
+
+int irtkBackend::ExecuteSimulateSlices(ebbrt::IOBuf::DataPointer& dp) { 
+
+  auto start = startTimer();
+  auto initialize = SimulateSlices(dp);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SIMULATE_SLICES].time += stop - start; 
+  _phase_performance[SIMULATE_SLICES].calls++;
+  Trace(TRACE_PHASE, SIMULATE_SLICES, 0, 0, start, stop);
+
+  if (_debug) {
+    PrintImageSums("[SimulateSlices output]");
+    cout << "[SimulateSlices output] " << seconds << endl;
+  }
+
+  return initialize;
+}
+
+void irtkBackend::ExecuteInitializeRobustStatistics(Messenger::NetworkId frontEndNid) { 
+  auto start = startTimer();
+  double sigma;
+  int num;
+  InitializeRobustStatistics(sigma, num);
+  ReturnFromInitializeRobustStatistics(sigma, num, frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[INITIALIZE_ROBUST_STATISTICS].time += stop - start; 
+  _phase_performance[INITIALIZE_ROBUST_STATISTICS].calls++;
+  Trace(TRACE_PHASE, INITIALIZE_ROBUST_STATISTICS, 0, 0, start, stop);
+
+  if (_debug) {
+    cout << "[InitializeRobustStatistics output] sigma: " << sigma << endl;
+    cout << "[InitializeRobustStatistics output] num: " << num << endl; 
+    cout << "[InitializeRobustStatistics time]  " << seconds << endl; 
+  }
+}
+
+void irtkBackend::ExecuteMStep(Messenger::NetworkId frontEndNid) {
+  auto start = startTimer();
+  mStepReturnParameters parameters;
+  MStep(parameters);
+  ReturnFromMStep(parameters, frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[M_STEP].time += stop - start; 
+  _phase_performance[M_STEP].calls++;
+  Trace(TRACE_PHASE, M_STEP, 0, 0, start, stop);
+          
+  if (_debug) {
+    cout << "[MStep output] sigma: " << parameters.sigma << endl;
+    cout << "[MStep output] mix: " << parameters.mix << endl;
+    cout << "[MStep output] num: " << parameters.num << endl;
+    cout << "[MStep output] min: " << parameters.min << endl;
+    cout << "[MStep output] max: " << parameters.max << endl;
+    cout << "[MStep time] " << seconds << endl;
+  }
+}
+
+void irtkBackend::ExecuteEStepI(ebbrt::IOBuf::DataPointer& dp, 
+    Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  auto parameters = EStepI(dp);
+  ReturnFromEStepI(parameters, frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_I].time += stop - start; 
+  _phase_performance[E_STEP_I].calls++;
+  Trace(TRACE_PHASE, E_STEP_I, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[EStepI time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteEStepII(ebbrt::IOBuf::DataPointer& dp, 
+    Messenger::NetworkId frontEndNid) { 
+  auto start = startTimer();
+
+  auto parameters = EStepII(dp);
+  ReturnFromEStepII(parameters, frontEndNid);
+
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_II].time += stop - start; 
+  _phase_performance[E_STEP_II].calls++;
+  Trace(TRACE_PHASE, E_STEP_II, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[EStepII time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteEStepIII(ebbrt::IOBuf::DataPointer& dp, 
+    Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  auto parameters = EStepIII(dp);
+  ReturnFromEStepIII(parameters, frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[E_STEP_III].time += stop - start; 
+  _phase_performance[E_STEP_III].calls++;
+  Trace(TRACE_PHASE, E_STEP_III, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[EStepIII time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteScale(Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  Scale();
+  ReturnFrom(SCALE, frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SCALE].time += stop - start; 
+  _phase_performance[SCALE].calls++;
+  Trace(TRACE_PHASE, SCALE, 0, 0, start, stop);
+
+  if (_debug) {
+    PrintImageSums("[Scale output]");
+    cout << "[Scale time] " << seconds << endl;
+  }
+}
+
+void irtkBackend::ExecuteSuperResolution(ebbrt::IOBuf::DataPointer& dp, 
+    Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  SuperResolution(dp);
+  ReturnFromSuperResolution(frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SUPERRESOLUTION].time += stop - start; 
+  _phase_performance[SUPERRESOLUTION].calls++;
+  Trace(TRACE_PHASE, SUPERRESOLUTION, 0, 0, start, stop);
+
+  if (_debug) {
+    cout << fixed << "[SuperResolution output] _addon: " 
+      << SumImage(_addon) << endl;
+    cout << fixed << "[SuperResolution output] _confidenceMap: " 
+      << SumImage(_confidenceMap) << endl;
+    cout << "[SuperResolution time] " << seconds << endl;
+  }
+}
+
+void irtkBackend::ExecuteRestoreSliceIntensities() {
+
+  auto start = startTimer();
+  RestoreSliceIntensities();
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[RESTORE_SLICE_INTENSITIES].time += stop - start; 
+  _phase_performance[RESTORE_SLICE_INTENSITIES].calls++;
+  Trace(TRACE_PHASE, RESTORE_SLICE_INTENSITIES, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[RestoreSliceIntensities time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteScaleVolume(Messenger::NetworkId nid) {
+
+  auto start = startTimer();
+  auto parameters = ScaleVolume();
+  ReturnFromScaleVolume(parameters, nid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SCALE_VOLUME].time += stop - start; 
+  _phase_performance[SCALE_VOLUME].calls++;
+  Trace(TRACE_PHASE, SCALE_VOLUME, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[ScaleVolume time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteSliceToVolumeRegistration(
+    ebbrt::IOBuf::DataPointer& dp, Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  SliceToVolumeRegistration(dp);
+  ReturnFromSliceToVolumeRegistration(frontEndNid);
+  auto stop = TimerNow();
+  auto seconds = NsToSeconds(stop - start);
+  _phase_performance[SLICE_TO_VOLUME_REGISTRATION].time += stop - start; 
+  _phase_performance[SLICE_TO_VOLUME_REGISTRATION].calls++;
+  Trace(TRACE_PHASE, SLICE_TO_VOLUME_REGISTRATION, 0, 0, start, stop);
+
+  if (_debug)
+    cout << "[SliceToVolumeRegistration time] " << seconds << endl;
+}
+
+void irtkBackend::ExecuteRebalance(ebbrt::IOBuf::DataPointer& dp, 
+    Messenger::NetworkId frontEndNid) { 
+
+  auto start = startTimer();
+  Rebalance(dp);
+  ReturnFrom(REBALANCE, frontEndNid);
+  auto seconds = endTimer(start);
+  Trace(TRACE_PHASE, REBALANCE, 0, 0, start, TimerNow());
+
+  if (_debug)
+    cout << "[Rebalance time] " << seconds << endl;
+}
+
+/*
+ * The subject of this front-end is done, free its slices and coefficients
+ * before the next one is bootstrapped. Not answered.
+ */
+void irtkBackend::Release() {
+  vector<irtkRealImage>().swap(_slices);
+  vector<irtkRealImage>().swap(_weights);
+  vector<irtkRealImage>().swap(_bias);
+  vector<irtkRealImage>().swap(_simulatedSlices);
+  vector<irtkRealImage>().swap(_simulatedInside);
+  vector<irtkRealImage>().swap(_simulatedWeights);
+  vector<SLICECOEFFS>().swap(_volcoeffs);
+  vector<irtkRigidTransformation>().swap(_transformations);
+  vector<int>().swap(_sliceInsideCPU);
+  vector<int>().swap(_voxelNum);
+
+  _reconstructed = irtkRealImage();
+  _mask = irtkRealImage();
+  _volumeWeights = irtkRealImage();
+  _addon = irtkRealImage();
+  _confidenceMap = irtkRealImage();
+}
+
+void irtkBackend::HandleMessage(Messenger::NetworkId nid,
+    ebbrt::IOBuf& buffer, size_t cpu) {
+
+  auto len = buffer.ComputeChainDataLength();
+  auto dp = buffer.GetDataPointer();
+  auto fn = dp.Get<int>();
+  if (fn < WORK_PHASES)
+    _phase_performance[fn].recv += len; 
+
+  auto now = TimerNow();
+  Trace(TRACE_RECV, fn, 0, len, now, now);
+
+  auto& message = _messages[MessageType(fn)];
+  message.recv++;
+  message.recvBytes += len;
+
+  // Replies handled inline while this message is (local backends) restore
+  // the counter, so the difference is this message's deserialization
+  auto deserializeStart = DeserializeTime();
+
+  if (_debug) {
+    cout << "Receiving function: " << fn << " on CPU: " 
+      << ebbrt::Cpu::GetMine() <<  endl;
+  }
+  switch(fn) {
+    case COEFF_INIT:
+      {
+        if (ExecuteCoeffInit(dp, cpu))
+          ExecuteGaussianReconstruction(nid);
+        break;
+      }
+    case SIMULATE_SLICES:
+      {
+        auto initialize = ExecuteSimulateSlices(dp);
+        if (initialize)
+          ExecuteInitializeRobustStatistics(nid);
+        else
+          ExecuteMStep(nid);
+        break;
+      }
+    case E_STEP_I:
+      {
+        ExecuteEStepI(dp, nid); 
+        break;
+      }
+    case E_STEP_II:
+      {
+        ExecuteEStepII(dp, nid);
+        break;
+      }
+    case E_STEP_III:
+      {
+        ExecuteEStepIII(dp, nid);
+        break;
+      }
+    case SCALE:
+      {
+        ExecuteScale(nid);
+        break;
+      }
+    case SUPERRESOLUTION:
+      {
+        ExecuteSuperResolution(dp, nid);
+        break;
+      }
+    case RESTORE_SLICE_INTENSITIES:
+      {
+        ExecuteRestoreSliceIntensities(); 
+        ExecuteScaleVolume(nid);
+        break;
+      }
+    case SLICE_TO_VOLUME_REGISTRATION:
+      {
+        ExecuteSliceToVolumeRegistration(dp, nid); 
+        break;
+      }
+    case GATHER_TIMERS:
+      {
+        SendTimers(nid);
+        break;
+      }
+    case REBALANCE:
+      {
+        ExecuteRebalance(dp, nid);
+        break;
+      }
+    case RELEASE:
+      {
+        Release();
+        break;
+      }
+    case PING:
+      {
+        cout << "recevied ping message from " << nid.ToString() << endl;
+        break;
+      }
+    default:
+      cout << "Invalid option" << endl;
+  }
+
+  message.deserialize += DeserializeTime() - deserializeStart;
+  DeserializeTime() = deserializeStart;
+}
+
+#ifndef __EBBRT_BM__
+void irtkBackend::EnablePerfCounters() {
+  _perfCounters = true;
+}
+#endif
+
+phases_data irtkBackend::GetPhasePerformance() {
+  return _phase_performance;
+}
+
+uint64_t irtkBackend::CountCoefficients() {
+  uint64_t coefficients = 0;
+  for (int i = _start; i < _end && i < (int) _volcoeffs.size(); i++)
+    for (auto& column : _volcoeffs[i])
+      for (auto& voxel : column)
+        coefficients += voxel.size();
+  return coefficients;
+}
@@ -5,6 +5,8 @@
 #include <ebbrt/UniqueIOBuf.h>
 #include <ebbrt/StaticIOBuf.h>
 
+#include "utils.h"
+
 #pragma GCC diagnostic ignored "-Wunused-variable"
 #pragma GCC diagnostic ignored "-Wsign-compare"
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
@@ -50,6 +52,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlices(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeTransformations(
     vector<irtkRigidTransformation>& transformations) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(1 * sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = transformations.size();
@@ -63,6 +66,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeTransformations(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeTransformations(
     int start, int end, vector<irtkRigidTransformation>& transformations) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(1 * sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = transformations.size();
@@ -75,6 +79,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeTransformations(
 }
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageAttr(irtkRealImage ri) {
+  serializeTimer timer(SerializeTime());
   irtkImageAttributes at;
 
   at = ri.GetImageAttributes();
@@ -118,6 +123,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageAttr(irtkRealImage r
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageI2W(
     irtkRealImage& ri) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(2 * sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = ri.GetWorldToImageMatrix().Rows();
@@ -134,6 +140,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageI2W(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageW2I(
     irtkRealImage& ri) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(2 * sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = ri.GetWorldToImageMatrix().Rows();
@@ -150,6 +157,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImageW2I(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlice(
     irtkRealImage& ri) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = ri.GetSizeMat();
@@ -165,6 +173,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlice(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImage(
     irtkRealImage& img) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(0);
   buf->PrependChain(std::move(serializeImageAttr(img)));
   buf->PrependChain(std::move(serializeImageI2W(img)));
@@ -175,6 +184,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeImage(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeRigidTrans(
     irtkRigidTransformation& rt) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf((12 * sizeof(double)) + (8 * sizeof(int)));
   auto dp = buf->GetMutDataPointer();
 
@@ -215,6 +225,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeRigidTrans(
 
 inline void deserializeSlice(ebbrt::IOBuf::DataPointer& dp, 
     irtkRealImage& tmp) {
+  serializeTimer timer(DeserializeTime());
   auto x = dp.Get<int>();
   auto y = dp.Get<int>();
   auto z = dp.Get<int>();
@@ -274,6 +285,7 @@ inline void deserializeSlice(ebbrt::IOBuf::DataPointer& dp,
 
 inline void deserializeTransformations(
     ebbrt::IOBuf::DataPointer& dp, irtkRigidTransformation& tmp) {
+  serializeTimer timer(DeserializeTime());
   auto tx = dp.Get<double>();
   auto ty = dp.Get<double>();
   auto tz = dp.Get<double>();
@@ -311,6 +323,7 @@ inline void deserializeTransformations(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlices(
     vector<irtkRealImage>& slices) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = slices.size();
@@ -327,6 +340,7 @@ inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlices(
 
 inline std::unique_ptr<ebbrt::MutUniqueIOBuf> serializeSlices(
     int start, int end, vector<irtkRealImage>& slices) {
+  serializeTimer timer(SerializeTime());
   auto buf = MakeUniqueIOBuf(sizeof(int));
   auto dp = buf->GetMutDataPointer();
   dp.Get<int>() = slices.size();
@@ -22,17 +22,37 @@
 #define SCALE_VOLUME 11
 #define SLICE_TO_VOLUME_REGISTRATION 12
 #define GATHER_TIMERS 13
+#define REBALANCE 14
+#define RELEASE 15
 #define PING 100
 
+// Second field of a COEFF_INIT message
+#define COEFF_INIT_PARAMETERS 0
+#define COEFF_INIT_BOOTSTRAP 1
+#define COEFF_INIT_STREAM_START 2
+#define COEFF_INIT_STREAM_SLICES 3
+#define COEFF_INIT_STREAM_END 4
+#define COEFF_INIT_RESUME 5
+
 
 #define WORK_PHASES 13
 
-#include <sys/time.h>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <array>
 #include <iostream>
 
+#ifdef __EBBRT_BM__
+#include <ebbrt/native/Clock.h>
+#else
+#include <chrono>
+#endif
+
+#if defined(TSC_TIMERS) && !defined(TSC_GHZ)
+#error "TSC_TIMERS needs TSC_GHZ, the TSC frequency in GHz"
+#endif
+
 using namespace std;
 
 typedef std::array<struct phase_data, WORK_PHASES> phases_data;
@@ -55,15 +75,15 @@ typedef struct unsigned_three {
   unsigned int x, y, z;
 } uint3;
 
+// PSF coefficient of a slice voxel: a voxel of the reconstructed volume, as
+// its index in GetPointerToVoxels() order, and its weight
 struct POINT3D {
-  short x;
-  short y;
-  short z;
+  uint32_t index;
   float value;
 
   template <typename Archive> void serialize(Archive& ar, 
       const unsigned int version) {
-    ar & x & y & z & value;
+    ar & index & value;
   }  
 };
 
@@ -83,6 +103,12 @@ struct arguments {
   string maskName;
   string tFolder;
   string sFolder;
+  string timingsFile;
+  string traceFile;
+  string metricsSocket;
+  string checkpointFile;
+  string batchFile;
+  string intermediatesFolder;
 
   vector<string> inputStacks;
   vector<string> inputTransformations;
@@ -96,6 +122,8 @@ struct arguments {
   int numThreads;
   int numBackendNodes;
   int numFrontendCPUs;
+  int psfSubdivisions;
+  int coarseIterations;
 
   unsigned int numInputStacksTuner;
   unsigned int T1PackageSize;
@@ -108,20 +136,36 @@ struct arguments {
   double lastIterLambda;
   double smoothMask;
   double lowIntensityCutoff;
+  double analyticPSF;
+  double convergence;
+  double coarseFactor;
+  double rebalanceThreshold;
+  double localLatency;
+  double localBandwidth;
 
   bool globalBiasCorrection;
   bool intensityMatching;
   bool debug;
   bool disableBiasCorr;
+  bool rebalance;
+  bool localBackends;
+  bool orderedReplies;
+  bool perfCounters;
+  bool resume;
+  bool streamSlices;
+  bool mmapInputs;
+  bool asyncOutput;
 };
 
 // Initialization parameters
 struct reconstructionParameters {
   bool globalBiasCorrection;
   bool adaptive;
+  bool trace;
 
   int sigmaBias;
   int numThreads;
+  int psfSubdivisions;
   int start;
   int end;
 
@@ -146,6 +190,7 @@ struct coeffInitParameters {
   double lambda;
   double alpha;
   double qualityFactor;
+  double psfRadius;
 };
 
 // EStep() function parameters
@@ -186,13 +231,54 @@ struct scaleVolumeParameters {
   double den;
 };
 
+// State of the EM saved after each outer iteration (--checkpoint)
+struct checkpointParameters {
+  int version;
+  int iteration;
+  int slices;
+
+  double delta;
+  double lambda;
+  double alpha;
+  double sigmaCPU;
+  double sigmaSCPU;
+  double sigmaS2CPU;
+  double mixCPU;
+  double mixSCPU;
+  double mCPU;
+  double maxIntensity;
+  double minIntensity;
+};
+
+// Times are in nanoseconds
 struct phase_data {
-  float time = 0.0;
-  float wait = 0.0;
+  uint64_t time = 0;
+  uint64_t wait = 0;
+  uint32_t calls = 0;
   uint32_t sent = 0;
   uint32_t recv = 0;
 };
 
+// Time each backend worker spent running its share of a phase and waiting
+// for the other workers, in nanoseconds
+struct worker_data {
+  uint64_t busy = 0;
+  uint64_t idle = 0;
+};
+
+typedef std::array<struct worker_data, WORK_PHASES> worker_phases_data;
+
+// Hardware counters of the backend kernels, only sampled by in-process
+// backends (--perfCounters)
+struct counter_data {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  uint64_t cacheMisses = 0;
+  uint64_t branchMisses = 0;
+};
+
+typedef std::array<struct counter_data, WORK_PHASES> counters_data;
+
 struct timers {
   float coeffInit;
   float gaussianReconstruction;
@@ -210,18 +296,176 @@ struct timers {
   float totalExecutionTime;
 };
 
-inline struct timeval startTimer() {
-  struct timeval start;
-  gettimeofday(&start, NULL);
-  return start;
+// Message accounting per type, i.e. per function the message belongs to,
+// with a last type for the rest (pings, releases)
+#define MESSAGE_TYPES (REBALANCE + 2)
+#define LATENCY_BUCKETS 32
+
+struct message_data {
+  uint32_t sent = 0;
+  uint32_t recv = 0;
+  uint64_t sentBytes = 0;
+  uint64_t recvBytes = 0;
+  // Nanoseconds spent building the messages sent and reading those received
+  uint64_t serialize = 0;
+  uint64_t deserialize = 0;
+  // Round trips, bucket i counts latencies below 2^i microseconds
+  uint32_t latency[LATENCY_BUCKETS] = {};
+};
+
+typedef std::array<struct message_data, MESSAGE_TYPES> messages_data;
+
+inline int MessageType(int fn) {
+  return (fn >= 0 && fn <= REBALANCE) ? fn : MESSAGE_TYPES - 1;
 }
 
-inline float endTimer(struct timeval start) {
-  struct timeval end;
-  gettimeofday(&end, NULL);
-  float seconds = (end.tv_sec - start.tv_sec) + 
-    ((end.tv_usec - start.tv_usec) / 1000000.0);
-  return seconds;
+// Timeline events, gathered from every node and exported as a Chrome trace
+#define TRACE_PHASE 0
+#define TRACE_WORKER 1
+#define TRACE_WAIT 2
+#define TRACE_SEND 3
+#define TRACE_RECV 4
+
+struct trace_event {
+  uint32_t type;
+  uint32_t phase;
+  uint32_t thread;
+  uint32_t bytes;
+  // Nanoseconds on the clock of the node that recorded the event
+  uint64_t begin;
+  uint64_t end;
+};
+
+inline string TracePhaseName(uint32_t phase) {
+  if (phase < WORK_PHASES)
+    return PhaseNames[phase];
+  switch (phase) {
+    case GATHER_TIMERS:
+      return "gatherTimers";
+    case REBALANCE:
+      return "rebalance";
+    case RELEASE:
+      return "release";
+    case PING:
+      return "ping";
+  }
+  return "unknown";
+}
+
+// Monotonic clock in nanoseconds: steady_clock on hosted, the EbbRT clock on
+// native. Build with -DTSC_TIMERS -DTSC_GHZ=<frequency> to read the TSC
+// directly, on machines with an invariant TSC.
+inline uint64_t TimerNow() {
+#if defined(TSC_TIMERS)
+  return (uint64_t) (__builtin_ia32_rdtsc() / (double) TSC_GHZ);
+#elif defined(__EBBRT_BM__)
+  return ebbrt::clock::Uptime().count();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline double NsToSeconds(uint64_t ns) {
+  return ns / 1000000000.0;
+}
+
+inline uint64_t startTimer() {
+  return TimerNow();
+}
+
+inline float endTimer(uint64_t start) {
+  return NsToSeconds(TimerNow() - start);
+}
+
+// Time the current thread spent in serialize.h, to be charged to the message
+// it builds or handles. Nested calls are counted once.
+inline uint64_t& SerializeTime() {
+  static thread_local uint64_t ns = 0;
+  return ns;
+}
+
+inline uint64_t& DeserializeTime() {
+  static thread_local uint64_t ns = 0;
+  return ns;
+}
+
+class serializeTimer {
+  public:
+    serializeTimer(uint64_t& total) : _total(total) {
+      if (Depth()++ == 0)
+        _start = TimerNow();
+    }
+
+    ~serializeTimer() {
+      if (--Depth() == 0)
+        _total += TimerNow() - _start;
+    }
+
+  private:
+    static int& Depth() {
+      static thread_local int depth = 0;
+      return depth;
+    }
+
+    uint64_t& _total;
+    uint64_t _start = 0;
+};
+
+// Returns the serialization time since the last call
+inline uint64_t TakeSerializeTime() {
+  auto ns = SerializeTime();
+  SerializeTime() = 0;
+  return ns;
+}
+
+inline void AddLatency(struct message_data& m, uint64_t ns) {
+  uint64_t us = ns / 1000;
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && (1ull << bucket) <= us)
+    bucket++;
+  m.latency[bucket]++;
+}
+
+// Upper bound in microseconds of the given fraction of the round trips
+inline uint64_t LatencyPercentile(struct message_data& m, double fraction) {
+  uint64_t total = 0;
+  for (auto n : m.latency)
+    total += n;
+  if (total == 0)
+    return 0;
+
+  uint64_t count = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    count += m.latency[i];
+    if (count >= fraction * total)
+      return 1ull << i;
+  }
+  return 1ull << (LATENCY_BUCKETS - 1);
+}
+
+inline void PrintMessageHeaders() {
+  cout << "node,message,sent,recv,sentBytes,recvBytes,serialize,deserialize,"
+    << "roundTrips,p50us,p90us,p99us" << endl;
+}
+
+inline void PrintMessagesData(string label, messages_data& md) {
+  for (int i = 0; i < MESSAGE_TYPES; i++) {
+    auto& m = md[i];
+    if (m.sent == 0 && m.recv == 0)
+      continue;
+
+    uint64_t roundTrips = 0;
+    for (auto n : m.latency)
+      roundTrips += n;
+
+    cout << label << "," << ((i < MESSAGE_TYPES - 1) ? TracePhaseName(i) :
+        "other") << "," << m.sent << "," << m.recv << "," << m.sentBytes
+      << "," << m.recvBytes << "," << NsToSeconds(m.serialize) << ","
+      << NsToSeconds(m.deserialize) << "," << roundTrips << ","
+      << LatencyPercentile(m, 0.5) << "," << LatencyPercentile(m, 0.9) << ","
+      << LatencyPercentile(m, 0.99) << endl;
+  }
 }
 
 inline void PrintPhaseHeaders() {
@@ -236,17 +480,24 @@ inline void PrintPhasesData(string label, phases_data pd) {
   uint64_t dsum = 0;
   cout << label << ",time,";
   for (auto p : pd){
-    cout << p.time << ",";
-    tsum += p.time;
+    cout << NsToSeconds(p.time) << ",";
+    tsum += NsToSeconds(p.time);
   }
   cout << tsum << endl;
   tsum = 0.0;
   cout << label << ",wait,";
   for (auto p : pd){
-    cout << p.wait << ",";
-    tsum += p.wait;
+    cout << NsToSeconds(p.wait) << ",";
+    tsum += NsToSeconds(p.wait);
   }
   cout << tsum << endl;
+  cout << label << ",calls,";
+  for (auto p : pd){
+    cout << p.calls << ",";
+    dsum += p.calls;
+  }
+  cout << dsum << endl;
+  dsum = 0;
   cout << label << ",sent,";
   for (auto p : pd){
     cout << p.sent << ",";
@@ -262,4 +513,110 @@ inline void PrintPhasesData(string label, phases_data pd) {
   cout << dsum << endl;
 }
 
+// Imbalance (max/mean busy time) between the workers in each phase and
+// over all phases, 0 where they did no work
+inline void PrintImbalance(vector<worker_phases_data>& workers) {
+  vector<double> total(workers.size(), 0.0);
+  for (int i = 0; i <= WORK_PHASES; i++) {
+    double max = 0.0;
+    double mean = 0.0;
+    for (int w = 0; w < (int) workers.size(); w++) {
+      double busy;
+      if (i < WORK_PHASES) {
+        busy = NsToSeconds(workers[w][i].busy);
+        total[w] += busy;
+      } else {
+        busy = total[w];
+      }
+      max = (busy > max) ? busy : max;
+      mean += busy;
+    }
+    mean = workers.empty() ? 0 : mean / workers.size();
+    cout << ((mean > 0) ? max / mean : 0);
+    if (i < WORK_PHASES)
+      cout << ",";
+    else
+      cout << endl;
+  }
+}
+
+inline void PrintCountersData(string label, counters_data cd) {
+  struct counter_data sum;
+  for (auto c : cd) {
+    sum.cycles += c.cycles;
+    sum.instructions += c.instructions;
+    sum.cacheMisses += c.cacheMisses;
+    sum.branchMisses += c.branchMisses;
+  }
+  if (sum.cycles == 0 && sum.instructions == 0)
+    return;
+
+  cout << label << ",cycles,";
+  for (auto c : cd)
+    cout << c.cycles << ",";
+  cout << sum.cycles << endl;
+  cout << label << ",instructions,";
+  for (auto c : cd)
+    cout << c.instructions << ",";
+  cout << sum.instructions << endl;
+  cout << label << ",ipc,";
+  for (auto c : cd)
+    cout << ((c.cycles > 0) ? (double) c.instructions / c.cycles : 0) << ",";
+  cout << ((sum.cycles > 0) ? (double) sum.instructions / sum.cycles : 0)
+    << endl;
+  cout << label << ",llcMisses,";
+  for (auto c : cd)
+    cout << c.cacheMisses << ",";
+  cout << sum.cacheMisses << endl;
+  cout << label << ",branchMisses,";
+  for (auto c : cd)
+    cout << c.branchMisses << ",";
+  cout << sum.branchMisses << endl;
+}
+
+// Busy and idle time of every worker and their imbalance
+inline void PrintWorkersData(string label,
+    vector<worker_phases_data>& workers) {
+  for (int w = 0; w < (int) workers.size(); w++) {
+    auto busy = 0.0;
+    auto idle = 0.0;
+    cout << label << "_w" << w << ",busy,";
+    for (auto p : workers[w]) {
+      cout << NsToSeconds(p.busy) << ",";
+      busy += NsToSeconds(p.busy);
+    }
+    cout << busy << endl;
+    cout << label << "_w" << w << ",idle,";
+    for (auto p : workers[w]) {
+      cout << NsToSeconds(p.idle) << ",";
+      idle += NsToSeconds(p.idle);
+    }
+    cout << idle << endl;
+  }
+  cout << label << ",imbalance,";
+  PrintImbalance(workers);
+}
+
+// One row per phase, for the machine-readable timings file
+inline void WritePhasesHeader(ostream& out) {
+  out << "node,phase,time,wait,calls,sent,recv" << endl;
+}
+
+inline void WritePhaseData(ostream& out, string label, string name,
+    struct phase_data p) {
+  out << label << "," << name << "," << NsToSeconds(p.time) << ","
+    << NsToSeconds(p.wait) << "," << p.calls << "," << p.sent << ","
+    << p.recv << endl;
+}
+
+inline void WritePhasesData(ostream& out, string label, phases_data pd) {
+  for (int i = 0; i < WORK_PHASES; i++)
+    WritePhaseData(out, label, PhaseNames[i], pd[i]);
+}
+
+// Whole-run times, with the per-phase columns left empty
+inline void WriteTotalData(ostream& out, string name, double seconds) {
+  out << "total," << name << "," << seconds << ",,,," << endl;
+}
+
 #endif // end of UTILS_H